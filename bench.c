@@ -0,0 +1,439 @@
+/* See LICENSE for license details. */
+#include <errno.h>
+#include <locale.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <X11/Xlib.h>
+
+char *argv0;
+#include "arg.h"
+#include "util.h"
+#include "config.h"
+#include "st.h"
+#include "win.h"
+
+/* Headless throughput benchmark: byte streams are fed through twrite() in
+ * ttyread() sized chunks and the screen is "drawn" into the stubs below as
+ * often as st would draw under load. */
+
+typedef struct {
+	char *s;
+	size_t len, siz;
+} Buf;
+
+static void bprintf(Buf *, const char *, ...);
+static void bputs(Buf *, const char *);
+static void bwrite(Buf *, const char *, size_t);
+static void readfile(Buf *, const char *);
+static void sinkreplies(void);
+static void bench(const char *, const char *, size_t);
+static void genascii(Buf *);
+static void genyes(Buf *);
+static void gensgr(Buf *);
+static void gentruecolor(Buf *);
+static void genunicode(Buf *);
+static void gencursor(Buf *);
+static void usage(void);
+
+static struct {
+	const char *name;
+	void (*gen)(Buf *);
+} workloads[] = {
+	{ "ascii",     genascii     },
+	{ "yes",       genyes       },
+	{ "sgr256",    gensgr       },
+	{ "truecolor", gentruecolor },
+	{ "unicode",   genunicode   },
+	{ "cursor",    gencursor    },
+};
+
+static size_t target = 8 << 20; /* size of generated workloads */
+static int iterations = 1;
+static int tcols = 80, trows = 24;
+static unsigned long nlines; /* lines handed to xdrawline() */
+static uint winmode;
+static Term *term;
+
+/* win.h stubs */
+void
+xbell(void)
+{ }
+
+void
+xclipcopy(void)
+{ }
+
+void
+xclippaste(void)
+{ }
+
+void
+xfocuspane(int dir)
+{ }
+
+void
+xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
+{ }
+
+void
+xdrawline(Line line, int x1, int y, int x2)
+{ nlines++; }
+
+void
+xfinishdraw(void)
+{ }
+
+void
+xloadcolors(void)
+{ }
+
+int
+xsetcolorname(int x, const char *name)
+{ return 0; }
+
+void
+xseticontitle(char *p)
+{ }
+
+void
+xsettitle(char *p)
+{ }
+
+int
+xsetcursor(int cursor)
+{ return 0; }
+
+void
+xsetpointermotion(int set)
+{ }
+
+void
+xsplit(int vert)
+{ }
+
+void
+xsearch(void)
+{ }
+
+void
+xselpaste(void)
+{ }
+
+void
+xsetsel(char *str)
+{ free(str); }
+
+int
+xstartdraw(void)
+{ return 1; }
+
+void
+xximspot(int x, int y)
+{ }
+
+void
+xzoomabs(double fontsize)
+{ }
+
+void
+xzoomrel(double delta)
+{ }
+
+void
+xzoomrst(void)
+{ }
+
+uint
+xmode(uint set, uint clr)
+{
+	winmode = (~winmode & set) | (winmode & ~clr);
+	return winmode;
+}
+
+void
+bprintf(Buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->s + b->len, b->siz - b->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			die("vsnprintf: %s\n", strerror(errno));
+		if (b->len + n < b->siz)
+			break;
+		b->siz = 2 * b->siz + n + 1;
+		b->s = xrealloc(b->s, b->siz);
+	}
+	b->len += n;
+}
+
+void
+bputs(Buf *b, const char *s)
+{
+	bwrite(b, s, strlen(s));
+}
+
+void
+bwrite(Buf *b, const char *s, size_t len)
+{
+	if (b->siz - b->len < len) {
+		b->siz = 2 * b->siz + len;
+		b->s = xrealloc(b->s, b->siz);
+	}
+	memcpy(b->s + b->len, s, len);
+	b->len += len;
+}
+
+void
+readfile(Buf *b, const char *path)
+{
+	FILE *fp;
+	Buf line = {0};
+	double t;
+	size_t n, len;
+	int c;
+
+	if (!(fp = fopen(path, "r")))
+		die("open '%s' failed: %s\n", path, strerror(errno));
+
+	/* asciicast recordings (st -r) are replayed event by event, anything
+	 * else is taken as a raw capture (st -o) */
+	if ((c = getc(fp)) == '{') {
+		line.s = xmalloc(line.siz = BUFSIZ);
+		while (fgets(line.s + line.len, line.siz - line.len, fp)) {
+			line.len += strlen(line.s + line.len);
+			if (line.s[line.len - 1] != '\n' && !feof(fp)) {
+				line.s = xrealloc(line.s, line.siz *= 2);
+				continue;
+			}
+			if (castdec(line.s, &t, &len) == 'o')
+				bwrite(b, line.s, len);
+			line.len = 0;
+		}
+		free(line.s);
+	} else {
+		ungetc(c, fp);
+		do {
+			if (b->siz - b->len < BUFSIZ)
+				b->s = xrealloc(b->s, b->siz = 2 * b->siz + BUFSIZ);
+			n = fread(b->s + b->len, 1, b->siz - b->len, fp);
+			b->len += n;
+		} while (n > 0);
+	}
+	if (ferror(fp))
+		die("read '%s' failed: %s\n", path, strerror(errno));
+	fclose(fp);
+}
+
+/* Replies to queries in the stream (DA, DSR, ...) are written to cmdfd,
+ * which is stdin as long as no tty has been opened. Point it at a pipe
+ * drained by a child, so that they neither fail nor block. */
+void
+sinkreplies(void)
+{
+	char buf[BUFSIZ];
+	int fd[2];
+
+	if (pipe(fd) < 0)
+		die("pipe failed: %s\n", strerror(errno));
+	switch (fork()) {
+	case -1:
+		die("fork failed: %s\n", strerror(errno));
+	case 0:
+		close(fd[1]);
+		while (read(fd[0], buf, sizeof(buf)) > 0)
+			;
+		_exit(0);
+	}
+	close(fd[0]);
+	dup2(fd[1], 0);
+	close(fd[1]);
+}
+
+/* cat of a log file */
+void
+genascii(Buf *b)
+{
+	unsigned long i;
+
+	for (i = 0; b->len < target; i++) {
+		bprintf(b, "%lu: [info] request %08lx served in %lu ms from "
+		        "/var/lib/app/cache/%lu\r\n", i, i * 2654435761UL,
+		        i % 997, i % 64);
+	}
+}
+
+void
+genyes(Buf *b)
+{
+	while (b->len < target)
+		bputs(b, "y\r\ny\r\ny\r\ny\r\ny\r\ny\r\ny\r\ny\r\n");
+}
+
+void
+gensgr(Buf *b)
+{
+	unsigned long i;
+
+	for (i = 0; b->len < target; i++) {
+		bprintf(b, "\033[38;5;%lum\033[48;5;%lum%c", i % 256,
+		        (i / 7) % 256, (int)(' ' + 1 + i % 94));
+		if (i % 64 == 63)
+			bputs(b, "\033[0m\r\n");
+	}
+}
+
+void
+gentruecolor(Buf *b)
+{
+	unsigned long i;
+
+	for (i = 0; b->len < target; i++) {
+		bprintf(b, "\033[38;2;%lu;%lu;%lum\033[48;2;%lu;%lu;%lum▀",
+		        i % 256, (i / 3) % 256, (i / 5) % 256,
+		        255 - i % 256, (i / 11) % 256, (i / 2) % 256);
+		if (i % 64 == 63)
+			bputs(b, "\033[0m\r\n");
+	}
+}
+
+/* wide, combining, astral plane and broken sequences */
+void
+genunicode(Buf *b)
+{
+	static const char *pieces[] = {
+		"日本語のテキスト", "한국어", "中文字符", "é", "ạ̈",
+		"\U0001F600", "\U0001F468‍\U0001F469‍\U0001F467",
+		"مرحبا", "─│┌┐",
+		"\xff\xfe", "\xe2\x82", "ascii ", "\t",
+	};
+	unsigned long i;
+
+	for (i = 0; b->len < target; i++) {
+		bputs(b, pieces[i % LEN(pieces)]);
+		if (i % 23 == 22)
+			bputs(b, "\r\n");
+	}
+}
+
+/* full screen applications (vim, htop): cursor motion, erases, scroll
+ * regions and attribute changes all over the screen */
+void
+gencursor(Buf *b)
+{
+	unsigned long i;
+
+	for (i = 0; b->len < target; i++) {
+		bprintf(b, "\033[%lu;%luH\033[%lum%5lu.%lu%%\033[0m\033[K",
+		        1 + i % trows, 1 + (i * 7) % tcols, 31 + i % 7,
+		        i % 10000, i % 10);
+		if (i % 97 == 0)
+			bprintf(b, "\033[2;%dr\033[%dH\n\033[r", trows - 1, trows);
+		if (i % 1009 == 0)
+			bputs(b, "\033[H\033[2J");
+	}
+}
+
+void
+bench(const char *name, const char *data, size_t len)
+{
+	struct timespec t0, t1, lastdraw;
+	double parse = 0, drw = 0, total;
+	size_t off, chunk;
+	int i, n;
+	unsigned long frames = 0;
+
+	twrite(term, "\033c", 2, 0);
+	nlines = 0;
+	clock_gettime(CLOCK_MONOTONIC, &lastdraw);
+	for (i = 0; i < iterations; i++) {
+		for (off = 0; off < len; off += n) {
+			chunk = MIN(len - off, BUFSIZ);
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			n = twrite(term, data + off, chunk, 0);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			parse += TIMEDIFF(t1, t0);
+			if (n == 0) /* truncated UTF-8 sequence at the end */
+				break;
+
+			/* st draws at most every maxlatency ms under load */
+			if (TIMEDIFF(t1, lastdraw) >= maxlatency ||
+			    off + n == len) {
+				draw(term);
+				clock_gettime(CLOCK_MONOTONIC, &lastdraw);
+				drw += TIMEDIFF(lastdraw, t1);
+				frames++;
+			}
+		}
+	}
+
+	total = parse + drw;
+	printf("%-12s %10zu %9.2f %8.2f %10.2f %10.2f %7lu %9lu\n", name,
+	       len * iterations, total > 0 ? len * iterations / total / 1E3 : 0,
+	       len > 0 ? total * 1E6 / (len * iterations) : 0,
+	       parse, drw, frames, nlines);
+}
+
+void
+usage(void)
+{
+	die("usage: %s [-g colsxrows] [-n iterations] [-s megabytes]"
+	    " [file ...]\n", argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Buf b = {0};
+	size_t i;
+
+	ARGBEGIN {
+	case 'g':
+		if (sscanf(EARGF(usage()), "%dx%d", &tcols, &trows) != 2)
+			usage();
+		break;
+	case 'n':
+		iterations = atoi(EARGF(usage()));
+		break;
+	case 's':
+		target = strtoul(EARGF(usage()), NULL, 10) << 20;
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	setlocale(LC_CTYPE, "");
+	tcols = MAX(tcols, 1);
+	trows = MAX(trows, 1);
+	iterations = MAX(iterations, 1);
+	sinkreplies();
+	term = tnew(tcols, trows);
+
+	printf("%-12s %10s %9s %8s %10s %10s %7s %9s\n", "workload", "bytes",
+	       "MB/s", "ns/byte", "twrite_ms", "draw_ms", "frames", "lines");
+	if (argc > 0) {
+		for (; argc > 0; argc--, argv++) {
+			b.len = 0;
+			readfile(&b, argv[0]);
+			bench(argv[0], b.s, b.len);
+		}
+	} else {
+		for (i = 0; i < LEN(workloads); i++) {
+			b.len = 0;
+			workloads[i].gen(&b);
+			bench(workloads[i].name, b.s, b.len);
+		}
+	}
+	free(b.s);
+
+	return 0;
+}
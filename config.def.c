@@ -11,18 +11,21 @@
 #include "st.h"
 #include "win.h"
 
-static void clipcopy(uint, Arg);
-static void clippaste(uint, Arg);
-static void selpaste(uint, Arg);
-static void zoomrel(uint, Arg);
-static void zoomrst(uint, Arg);
-static void numlock(uint, Arg);
-static void sendstr(uint, Arg);
-static void sendcsi(uint, Arg);
-static void printscreen(uint, Arg);
-static void selprint(uint, Arg);
-static void sendbreak(uint, Arg);
-static void togprinter(uint, Arg);
+static void clipcopy(Term *, uint, Arg);
+static void clippaste(Term *, uint, Arg);
+static void selpaste(Term *, uint, Arg);
+static void zoomrel(Term *, uint, Arg);
+static void zoomrst(Term *, uint, Arg);
+static void numlock(Term *, uint, Arg);
+static void sendstr(Term *, uint, Arg);
+static void sendcsi(Term *, uint, Arg);
+static void printscreen(Term *, uint, Arg);
+static void selprint(Term *, uint, Arg);
+static void sendbreak(Term *, uint, Arg);
+static void togprinter(Term *, uint, Arg);
+static void search(Term *, uint, Arg);
+static void split(Term *, uint, Arg);
+static void cyclepane(Term *, uint, Arg);
 
 /* See: http://freedesktop.org/software/fontconfig/fontconfig-user.html */
 char *font = "monospace:pixelsize=32:antialias=true:autohint=true";
@@ -54,6 +57,10 @@ uint tripleclicktimeout = 600;
 
 int allowaltscreen = 1;
 
+/* keep a signature of the lines on the screen, so that a search redraws
+ * only the lines which may match (set to 0 to disable) */
+int searchindex = 1;
+
 /* allow certain non-interactive (insecure) window operations, such as
    setting the clipboard text */
 int allowwindowops = 0;
@@ -181,6 +188,11 @@ Key keys[] = {
 	{ XK_C,         TERMMOD,  KEXCL(TERMMOD)|R,      clipcopy,  ARG_DUMMY },
 	{ XK_V,         TERMMOD,  KEXCL(TERMMOD)|R,     clippaste,  ARG_DUMMY },
 	{ XK_Y,         TERMMOD,  KEXCL(TERMMOD)|R,      selpaste,  ARG_DUMMY },
+	{ XK_E,         TERMMOD,  KEXCL(TERMMOD)|R,         split,  {.i =  1} },
+	{ XK_O,         TERMMOD,  KEXCL(TERMMOD)|R,         split,  {.i =  0} },
+	{ XK_N,         TERMMOD,  KEXCL(TERMMOD)|R,     cyclepane,  {.i = +1} },
+	{ XK_P,         TERMMOD,  KEXCL(TERMMOD)|R,     cyclepane,  {.i = -1} },
+	{ XK_F,         TERMMOD,  KEXCL(TERMMOD)|R,        search,  ARG_DUMMY },
 
 	/* ASCII special cases (handlesym handles most cases already) */
 	{ XK_space,          S,             R,  SENDCSI(' ',0,'u') },
@@ -319,55 +331,67 @@ confstate(uint xstate, int rels)
 }
 
 void
-clipcopy(uint state, Arg arg)
+clipcopy(Term *term, uint state, Arg arg)
 { xclipcopy(); }
 
 void
-clippaste(uint state, Arg arg)
+clippaste(Term *term, uint state, Arg arg)
 { xclippaste(); }
 
 void
-selpaste(uint state, Arg arg)
+selpaste(Term *term, uint state, Arg arg)
 { xselpaste(); }
 
 void
-zoomrel(uint state, Arg arg)
+zoomrel(Term *term, uint state, Arg arg)
 { xzoomrel(arg.d); }
 
 void
-zoomrst(uint state, Arg arg)
+zoomrst(Term *term, uint state, Arg arg)
 { xzoomrst(); }
 
 void
-numlock(uint state, Arg arg)
+numlock(Term *term, uint state, Arg arg)
 { xtogmode(MODE_NUMLOCK); }
 
 void
-sendstr(uint state, Arg arg)
-{ ttywrite(arg.str.s, arg.str.l, 1); }
+sendstr(Term *term, uint state, Arg arg)
+{ ttywrite(term, arg.str.s, arg.str.l, 1); }
 
 void
-sendcsi(uint state, Arg arg)
+sendcsi(Term *term, uint state, Arg arg)
 {
 	char buf[64];
 	size_t len;
 
 	len = csienc(buf, sizeof buf, state, arg.csi.n, arg.csi.m, arg.csi.c);
-	ttywrite(buf, len, 1);
+	ttywrite(term, buf, len, 1);
 }
 
 void
-printscreen(uint state, Arg arg)
-{ tdump(); }
+printscreen(Term *term, uint state, Arg arg)
+{ tdump(term); }
+
+void
+selprint(Term *term, uint state, Arg arg)
+{ tdumpsel(term); }
+
+void
+sendbreak(Term *term, uint state, Arg arg)
+{ tsendbreak(term); }
+
+void
+togprinter(Term *term, uint state, Arg arg)
+{ ttogprinter(term); }
 
 void
-selprint(uint state, Arg arg)
-{ tdumpsel(); }
+search(Term *term, uint state, Arg arg)
+{ xsearch(); }
 
 void
-sendbreak(uint state, Arg arg)
-{ tsendbreak(); }
+split(Term *term, uint state, Arg arg)
+{ xsplit(arg.i); }
 
 void
-togprinter(uint state, Arg arg)
-{ ttogprinter(); }
+cyclepane(Term *term, uint state, Arg arg)
+{ xfocuspane(arg.i); }
@@ -37,7 +37,8 @@ typedef union {
 #define ARG_STR(s_)       { .str.l = sizeof(s_)-1, .str.s = (s_) }
 #define ARG_CSI(n_,m_,c_) { .csi.n = (n_), .csi.m = (m_), .csi.c = (c_) }
 
-typedef void (*Handler)(uint state, Arg arg);
+struct Term;
+typedef void (*Handler)(struct Term *, uint state, Arg arg);
 
 /* Tristate logic: each bit in set/clr is interpreted as follows:
  * set  clr
@@ -78,6 +79,7 @@ extern wchar_t *worddelimiters;
 extern uint doubleclicktimeout;
 extern uint tripleclicktimeout;
 extern int allowaltscreen;
+extern int searchindex;
 extern int allowwindowops;
 extern double minlatency;
 extern double maxlatency;
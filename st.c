@@ -12,9 +12,12 @@
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <X11/Xlib.h> /* TODO gross? */
@@ -37,13 +40,15 @@
 #define ESC_ARG_SIZ 16
 #define STR_BUF_SIZ ESC_BUF_SIZ
 #define STR_ARG_SIZ ESC_ARG_SIZ
+#define REC_BUF_SIZ (64*1024)
 
 /* macros */
-#define IS_SET(flag)   ((term.mode & (flag)) != 0)
+#define IS_SET(flag)   ((term->mode & (flag)) != 0)
 #define ISCONTROLC0(c) (BETWEEN(c, 0, 0x1f) || (c) == 0x7f)
 #define ISCONTROLC1(c) (BETWEEN(c, 0x80, 0x9f))
 #define ISCONTROL(c)   (ISCONTROLC0(c) || ISCONTROLC1(c))
-#define ISDELIM(u)     (u && wcschr(worddelimiters, u))
+#define ATTREQ(a, b)   ((a).mode == (b).mode && (a).fg == (b).fg && \
+                        (a).bg == (b).bg)
 
 enum term_mode {
 	MODE_WRAP      = 1 << 0,
@@ -87,7 +92,7 @@ enum escape_state {
 };
 
 typedef struct {
-	Glyph attr; /* current char attributes */
+	Attr attr;  /* current char attributes */
 	int x;
 	int y;
 	char state;
@@ -109,27 +114,6 @@ typedef struct {
 	int alt;
 } Selection;
 
-/* Internal representation of the screen */
-typedef struct {
-	int row;         /* nb row */
-	int col;         /* nb col */
-	Line *line;      /* screen */
-	Line *alt;       /* alternate screen */
-	int *dirty;      /* dirtyness of lines */
-	TCursor c;       /* cursor */
-	int ocx;         /* old cursor col */
-	int ocy;         /* old cursor row */
-	int top;         /* top    scroll limit */
-	int bot;         /* bottom scroll limit */
-	int mode;        /* terminal mode flags */
-	int esc;         /* escape state flags */
-	char trantbl[4]; /* charset table translation */
-	int charset;     /* current charset */
-	int icharset;    /* selected charset for sequence */
-	int *tabs;
-	Rune lastc;      /* last printed char outside of sequence, 0 if control */
-} Term;
-
 /* CSI Escape sequence structs */
 /* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
 typedef struct {
@@ -152,217 +136,377 @@ typedef struct {
 	int narg;              /* nb of args */
 } STREscape;
 
+/* What is known of the contents of a line, from the writes to it */
+typedef struct {
+	uint32_t colors[8]; /* palette colors the line may use, a superset
+	                     * of them until the whole line is cleared */
+	int len;            /* past the last glyph which may not be blank */
+} Lineinfo;
+
+/* The main screen being rewrapped by tresize() */
+typedef struct {
+	int x[2], y[2]; /* cursors staying on their glyphs, old and then new
+	                 * positions; the rows of the first stay on screen */
+	int *fix;     /* glyphs to clear ATTR_WRAP on, y * col + x */
+	int nfix, fixsiz;
+	char *wrap;   /* rows to set it on */
+} Reflow;
+
+/* Bloom filter of the runes and pairs of runes of a line, telling the
+ * lines a search cannot match; made when needed, until the line is drawn */
+typedef struct {
+	uint64_t bits[8];
+	int ok;
+} Linesig;
+
+/* State of one terminal: screen, parser, selection and tty */
+struct Term {
+	int row;         /* nb row */
+	int col;         /* nb col */
+	Line *line;      /* screen */
+	Line *alt;       /* alternate screen */
+	Lineinfo *info;    /* what is known of each line */
+	Lineinfo *altinfo; /* same for the alternate screen */
+	int *dirty;      /* dirtyness of lines */
+	Rune *query;     /* text searched for, see tsearch() */
+	int querylen;
+	int *hit;        /* lines showing matches of query */
+	Linesig *sig;    /* of the lines drawn, for searches */
+	char *hl;        /* matches in the line being drawn */
+	TCursor c;       /* cursor */
+	TCursor sc[2];   /* saved cursors, normal and alternate screen */
+	int ocx;         /* old cursor col */
+	int ocy;         /* old cursor row */
+	int top;         /* top    scroll limit */
+	int bot;         /* bottom scroll limit */
+	int mode;        /* terminal mode flags */
+	int esc;         /* escape state flags */
+	char trantbl[4]; /* charset table translation */
+	int charset;     /* current charset */
+	int icharset;    /* selected charset for sequence */
+	int *tabs;
+	Rune lastc;      /* last printed char outside of sequence, 0 if control */
+	Selection sel;
+	CSIEscape csiescseq;
+	STREscape strescseq;
+
+	int cmdfd;
+	pid_t pid;
+	char ttybuf[BUFSIZ]; /* bytes read from the tty, not parsed yet */
+	int ttybuflen;
+	FILE *recfp;
+	struct timespec recstart;
+	int sessfd;      /* sts of an attached session */
+	char *sessbuf;   /* messages from sts, not handled yet */
+	size_t sessbuflen, sessbufsiz;
+	Attr *attrs;     /* of the glyphs, see tattr() */
+	uint32_t attrlen, attrcap;
+	uint32_t *attrtab; /* hash table of attrs, 2 * attrcap slots */
+	uint32_t attrlast; /* runs of glyphs share their attributes */
+	Term *next;      /* list of all terminals, for sigchld() */
+};
+
 static void execsh(char *, char **);
+static char *freadline(FILE *, char **, size_t *);
+static void recevent(Term *, int, const char *, size_t);
+static void replay(void);
+static size_t sessread(Term *);
+static void sessmsg(Term *, int, char *, size_t);
 static void stty(char **);
 static void sigchld(int);
-static void ttywriteraw(const char *, size_t);
-
-static void csidump(void);
-static void csihandle(void);
-static void csiparse(void);
-static void csireset(void);
-static int eschandle(uchar);
-static void strdump(void);
-static void strhandle(void);
-static void strparse(void);
-static void strreset(void);
-
-static void tprinter(char *, size_t);
-static void tdumpline(int);
-static void tclearregion(int, int, int, int);
-static void tcursor(int);
-static void tdeletechar(int);
-static void tdeleteline(int);
-static void tinsertblank(int);
-static void tinsertblankline(int);
-static int tlinelen(int);
-static void tmoveto(int, int);
-static void tmoveato(int, int);
-static void tnewline(int);
-static void tputtab(int);
-static void tputc(Rune);
-static void treset(void);
-static void tscrollup(int, int);
-static void tscrolldown(int, int);
-static void tsetattr(const int *, int);
-static void tsetchar(Rune, const Glyph *, int, int);
-static void tsetdirt(int, int);
-static void tsetscroll(int, int);
-static void tswapscreen(void);
-static void tsetmode(int, int, const int *, int);
-static int twrite(const char *, int, int);
-static void tfulldirt(void);
-static void tcontrolcode(uchar );
-static void tdectest(char );
-static void tdefutf8(char);
+static void childexit(int);
+static int closable(void);
+static void ttywriteraw(Term *, const char *, size_t);
+
+static void csidump(Term *);
+static void csihandle(Term *);
+static void csiparse(Term *);
+static void csireset(Term *);
+static int eschandle(Term *, uchar);
+static void strdump(Term *);
+static void strhandle(Term *);
+static void strparse(Term *);
+static void strreset(Term *);
+
+static void tprinter(const char *, size_t);
+static void tdumpline(Term *, int);
+static void tclearregion(Term *, int, int, int, int);
+static void tcursor(Term *, int);
+static void tdeletechar(Term *, int);
+static void tdeleteline(Term *, int);
+static void tinsertblank(Term *, int);
+static void tinsertblankline(Term *, int);
+static int tlinelen(Term *, int);
+static void tmoveto(Term *, int, int);
+static void tmoveato(Term *, int, int);
+static void tnewline(Term *, int);
+static void tputtab(Term *, int);
+static void tputc(Term *, Rune);
+static void treset(Term *);
+static void tscrollup(Term *, int, int);
+static void tscrolldown(Term *, int, int);
+static void tsetattr(Term *, const int *, int);
+static void tsetchar(Term *, Rune, const Attr *, int, int);
+static void tusecolor(Term *, int, const Attr *);
+static void tusecell(Term *, int, int, const Attr *);
+static void tresizelines(Term *, Line **, Lineinfo **, int, int, int);
+static void treflow(Term *, int, int, Reflow *);
+static void treflowwrap(Term *, Reflow *);
+static void tsetdirt(Term *, int, int);
+static void tsetscroll(Term *, int, int);
+static void tswapscreen(Term *);
+static void tsetmode(Term *, int, int, const int *, int);
+static void tfulldirt(Term *);
+static void tcontrolcode(Term *, uchar );
+static void tdectest(Term *, char );
+static void tdefutf8(Term *, char);
 static int32_t tdefcolor(const int *, int *, int);
-static void tdeftran(char);
-static void tstrsequence(uchar);
-
-static void drawregion(int, int, int, int);
-
-static void selnormalize(void);
-static void selscroll(int, int);
-static void selsnap(int *, int *, int);
+static void tdeftran(Term *, char);
+static void tstrsequence(Term *, uchar);
+
+static void drawregion(Term *, int, int, int, int);
+static int tsearchline(Term *, int);
+static void sigadd(Linesig *, Rune, Rune);
+static void sigquery(Linesig *, const Rune *, int);
+static int tmaymatch(Term *, int, const Linesig *);
+
+static void attrgc(Term *);
+static uint32_t attrkey(const Attr *);
+static void glyphmode(Term *, Glyph *, int, int);
+
+static void selinit(Term *);
+static void selnormalize(Term *);
+static void selscroll(Term *, int, int);
+static void selsnap(Term *, int *, int *, int);
+static void delimsinit(void);
+static int isdelim(Rune);
+static int runecmp(const void *, const void *);
 
 /* Globals */
-static Term term;
-static Selection sel;
-static CSIEscape csiescseq;
-static STREscape strescseq;
+static Term *terms;
+static uint32_t delimascii[4]; /* worddelimiters below 128, see isdelim() */
+static Rune *delimtab;         /* the others, sorted */
+static int delimlen = -1;
 static int iofd = 1;
-static int cmdfd;
-static pid_t pid;
+static FILE *playfp;
+static int playfast;
+static Term *playterm;          /* the one replaying playfp */
+static int childstat = -1;      /* of the shell of the last terminal */
+static int serving;             /* see ttyserve() */
 
 void
-selinit(void)
+selinit(Term *term)
 {
-	sel.mode = SEL_IDLE;
-	sel.snap = 0;
-	sel.ob.x = -1;
+	term->sel.mode = SEL_IDLE;
+	term->sel.snap = 0;
+	term->sel.ob.x = -1;
 }
 
 int
-tlinelen(int y)
+tlinelen(Term *term, int y)
 {
-	int i = term.col;
+	int i = term->col;
 
-	if (term.line[y][i - 1].mode & ATTR_WRAP)
+	if (term->attrs[term->line[y][i - 1].a].mode & ATTR_WRAP)
 		return i;
 
-	while (i > 0 && term.line[y][i - 1].u == ' ')
+	/* the blanks found stay known until the line is written again */
+	i = MIN(term->info[y].len, i);
+	while (i > 0 && term->line[y][i - 1].u == ' ')
 		--i;
+	term->info[y].len = i;
 
 	return i;
 }
 
 void
-selstart(int col, int row, int snap)
+selstart(Term *term, int col, int row, int snap)
 {
-	selclear();
-	sel.mode = SEL_EMPTY;
-	sel.type = SEL_REGULAR;
-	sel.alt = IS_SET(MODE_ALTSCREEN);
-	sel.snap = snap;
-	sel.oe.x = sel.ob.x = col;
-	sel.oe.y = sel.ob.y = row;
-	selnormalize();
+	selclear(term);
+	term->sel.mode = SEL_EMPTY;
+	term->sel.type = SEL_REGULAR;
+	term->sel.alt = IS_SET(MODE_ALTSCREEN);
+	term->sel.snap = snap;
+	term->sel.oe.x = term->sel.ob.x = col;
+	term->sel.oe.y = term->sel.ob.y = row;
+	selnormalize(term);
 
-	if (sel.snap != 0)
-		sel.mode = SEL_READY;
-	tsetdirt(sel.nb.y, sel.ne.y);
+	if (term->sel.snap != 0)
+		term->sel.mode = SEL_READY;
+	tsetdirt(term, term->sel.nb.y, term->sel.ne.y);
 }
 
 void
-selextend(int col, int row, int type, int done)
+selextend(Term *term, int col, int row, int type, int done)
 {
 	int oldey, oldex, oldsby, oldsey, oldtype;
 
-	if (sel.mode == SEL_IDLE)
+	if (term->sel.mode == SEL_IDLE)
 		return;
-	if (done && sel.mode == SEL_EMPTY) {
-		selclear();
+	if (done && term->sel.mode == SEL_EMPTY) {
+		selclear(term);
 		return;
 	}
 
-	oldey = sel.oe.y;
-	oldex = sel.oe.x;
-	oldsby = sel.nb.y;
-	oldsey = sel.ne.y;
-	oldtype = sel.type;
+	oldey = term->sel.oe.y;
+	oldex = term->sel.oe.x;
+	oldsby = term->sel.nb.y;
+	oldsey = term->sel.ne.y;
+	oldtype = term->sel.type;
 
-	sel.oe.x = col;
-	sel.oe.y = row;
-	selnormalize();
-	sel.type = type;
+	term->sel.oe.x = col;
+	term->sel.oe.y = row;
+	selnormalize(term);
+	term->sel.type = type;
 
-	if (oldey != sel.oe.y || oldex != sel.oe.x || oldtype != sel.type
-			|| sel.mode == SEL_EMPTY)
-		tsetdirt(MIN(sel.nb.y, oldsby), MAX(sel.ne.y, oldsey));
+	if (oldey != term->sel.oe.y || oldex != term->sel.oe.x || oldtype != term->sel.type
+			|| term->sel.mode == SEL_EMPTY)
+		tsetdirt(term, MIN(term->sel.nb.y, oldsby), MAX(term->sel.ne.y, oldsey));
 
-	sel.mode = done ? SEL_IDLE : SEL_READY;
+	term->sel.mode = done ? SEL_IDLE : SEL_READY;
 }
 
 void
-selnormalize(void)
+selnormalize(Term *term)
 {
 	int i;
 
-	if (sel.type == SEL_REGULAR && sel.ob.y != sel.oe.y) {
-		sel.nb.x = sel.ob.y < sel.oe.y ? sel.ob.x : sel.oe.x;
-		sel.ne.x = sel.ob.y < sel.oe.y ? sel.oe.x : sel.ob.x;
+	if (term->sel.type == SEL_REGULAR && term->sel.ob.y != term->sel.oe.y) {
+		term->sel.nb.x = term->sel.ob.y < term->sel.oe.y ? term->sel.ob.x : term->sel.oe.x;
+		term->sel.ne.x = term->sel.ob.y < term->sel.oe.y ? term->sel.oe.x : term->sel.ob.x;
 	} else {
-		sel.nb.x = MIN(sel.ob.x, sel.oe.x);
-		sel.ne.x = MAX(sel.ob.x, sel.oe.x);
+		term->sel.nb.x = MIN(term->sel.ob.x, term->sel.oe.x);
+		term->sel.ne.x = MAX(term->sel.ob.x, term->sel.oe.x);
 	}
-	sel.nb.y = MIN(sel.ob.y, sel.oe.y);
-	sel.ne.y = MAX(sel.ob.y, sel.oe.y);
+	term->sel.nb.y = MIN(term->sel.ob.y, term->sel.oe.y);
+	term->sel.ne.y = MAX(term->sel.ob.y, term->sel.oe.y);
 
-	selsnap(&sel.nb.x, &sel.nb.y, -1);
-	selsnap(&sel.ne.x, &sel.ne.y, +1);
+	selsnap(term, &term->sel.nb.x, &term->sel.nb.y, -1);
+	selsnap(term, &term->sel.ne.x, &term->sel.ne.y, +1);
 
 	/* expand selection over line breaks */
-	if (sel.type == SEL_RECTANGULAR)
+	if (term->sel.type == SEL_RECTANGULAR)
 		return;
-	i = tlinelen(sel.nb.y);
-	if (i < sel.nb.x)
-		sel.nb.x = i;
-	if (tlinelen(sel.ne.y) <= sel.ne.x)
-		sel.ne.x = term.col - 1;
+	i = tlinelen(term, term->sel.nb.y);
+	if (i < term->sel.nb.x)
+		term->sel.nb.x = i;
+	if (tlinelen(term, term->sel.ne.y) <= term->sel.ne.x)
+		term->sel.ne.x = term->col - 1;
 }
 
+/* The selected columns [*x1, *x2) of line y, so that callers dealing with
+ * runs of cells check the selection once per line */
 int
-selected(int x, int y)
+selspan(Term *term, int y, int *x1, int *x2)
 {
-	if (sel.mode == SEL_EMPTY || sel.ob.x == -1 ||
-			sel.alt != IS_SET(MODE_ALTSCREEN))
+	if (term->sel.mode == SEL_EMPTY || term->sel.ob.x == -1 ||
+			term->sel.alt != IS_SET(MODE_ALTSCREEN) ||
+			!BETWEEN(y, term->sel.nb.y, term->sel.ne.y))
 		return 0;
 
-	if (sel.type == SEL_RECTANGULAR)
-		return BETWEEN(y, sel.nb.y, sel.ne.y)
-			&& BETWEEN(x, sel.nb.x, sel.ne.x);
+	if (term->sel.type == SEL_RECTANGULAR) {
+		*x1 = term->sel.nb.x;
+		*x2 = term->sel.ne.x + 1;
+	} else {
+		*x1 = (y == term->sel.nb.y) ? term->sel.nb.x : 0;
+		*x2 = (y == term->sel.ne.y) ? term->sel.ne.x + 1 : term->col;
+	}
+	return *x1 < *x2;
+}
+
+int
+selected(Term *term, int x, int y)
+{
+	int x1, x2;
+
+	return selspan(term, y, &x1, &x2) && BETWEEN(x, x1, x2 - 1);
+}
+
+int
+runecmp(const void *a, const void *b)
+{
+	Rune x = *(const Rune *)a, y = *(const Rune *)b;
 
-	return BETWEEN(y, sel.nb.y, sel.ne.y)
-	    && (y != sel.nb.y || x >= sel.nb.x)
-	    && (y != sel.ne.y || x <= sel.ne.x);
+	return (x > y) - (x < y);
 }
 
+/* Build the tables of isdelim(), once: tnew() does it before any terminal
+ * is fed, so that they are only read afterwards */
 void
-selsnap(int *x, int *y, int direction)
+delimsinit(void)
 {
-	int newx, newy, xt, yt;
+	const wchar_t *w;
+
+	if (delimlen >= 0)
+		return;
+	delimlen = 0;
+	delimtab = xmalloc((wcslen(worddelimiters) + 1) * sizeof(Rune));
+	for (w = worddelimiters; *w; w++) {
+		if (*w < 128)
+			delimascii[*w >> 5] |= 1U << (*w & 31);
+		else
+			delimtab[delimlen++] = *w;
+	}
+	qsort(delimtab, delimlen, sizeof(Rune), runecmp);
+}
+
+int
+isdelim(Rune u)
+{
+	int lo, hi, mid;
+
+	if (u < 128)
+		return u && (delimascii[u >> 5] >> (u & 31) & 1);
+	for (lo = 0, hi = delimlen; lo < hi;) {
+		mid = (lo + hi) / 2;
+		if (delimtab[mid] == u)
+			return 1;
+		if (delimtab[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+void
+selsnap(Term *term, int *x, int *y, int direction)
+{
+	int newx, newy, xt, yt, len;
 	int delim, prevdelim;
 	const Glyph *gp, *prevgp;
 
-	switch (sel.snap) {
+	switch (term->sel.snap) {
 	case SNAP_WORD:
 		/* Snap around if the word wraps around at the end or
 		 * beginning of a line. */
-		prevgp = &term.line[*y][*x];
-		prevdelim = ISDELIM(prevgp->u);
+		prevgp = &term->line[*y][*x];
+		prevdelim = isdelim(prevgp->u);
+		len = tlinelen(term, *y);
 		for (;;) {
 			newx = *x + direction;
 			newy = *y;
-			if (!BETWEEN(newx, 0, term.col - 1)) {
+			if (!BETWEEN(newx, 0, term->col - 1)) {
 				newy += direction;
-				newx = (newx + term.col) % term.col;
-				if (!BETWEEN(newy, 0, term.row - 1))
+				newx = (newx + term->col) % term->col;
+				if (!BETWEEN(newy, 0, term->row - 1))
 					break;
 
 				if (direction > 0)
 					yt = *y, xt = *x;
 				else
 					yt = newy, xt = newx;
-				if (!(term.line[yt][xt].mode & ATTR_WRAP))
+				if (!(term->attrs[term->line[yt][xt].a].mode & ATTR_WRAP))
 					break;
+				len = tlinelen(term, newy);
 			}
 
-			if (newx >= tlinelen(newy))
+			if (newx >= len)
 				break;
 
-			gp = &term.line[newy][newx];
-			delim = ISDELIM(gp->u);
-			if (!(gp->mode & ATTR_WDUMMY) && (delim != prevdelim
+			gp = &term->line[newy][newx];
+			delim = isdelim(gp->u);
+			if (!(term->attrs[gp->a].mode & ATTR_WDUMMY) && (delim != prevdelim
 					|| (delim && gp->u != prevgp->u)))
 				break;
 
@@ -376,17 +520,17 @@ selsnap(int *x, int *y, int direction)
 		/* Snap around if the the previous line or the current one
 		 * has set ATTR_WRAP at its end. Then the whole next or
 		 * previous line will be selected. */
-		*x = (direction < 0) ? 0 : term.col - 1;
+		*x = (direction < 0) ? 0 : term->col - 1;
 		if (direction < 0) {
 			for (; *y > 0; *y += direction) {
-				if (!(term.line[*y-1][term.col-1].mode
+				if (!(term->attrs[term->line[*y-1][term->col-1].a].mode
 						& ATTR_WRAP)) {
 					break;
 				}
 			}
 		} else if (direction > 0) {
-			for (; *y < term.row-1; *y += direction) {
-				if (!(term.line[*y][term.col-1].mode
+			for (; *y < term->row-1; *y += direction) {
+				if (!(term->attrs[term->line[*y][term->col-1].a].mode
 						& ATTR_WRAP)) {
 					break;
 				}
@@ -397,41 +541,45 @@ selsnap(int *x, int *y, int direction)
 }
 
 char *
-getsel(void)
+getsel(Term *term)
 {
-	char *str, *ptr;
-	int y, bufsize, lastx, linelen;
+	char *str = NULL;
+	size_t len = 0, siz = 0, linesiz;
+	int y, lastx, linelen;
 	const Glyph *gp, *last;
 
-	if (sel.ob.x == -1)
+	if (term->sel.ob.x == -1)
 		return NULL;
 
-	bufsize = (term.col+1) * (sel.ne.y-sel.nb.y+1) * UTF_SIZ;
-	ptr = str = xmalloc(bufsize);
-
-	/* append every set & selected glyph to the selection */
-	for (y = sel.nb.y; y <= sel.ne.y; y++) {
-		if ((linelen = tlinelen(y)) == 0) {
-			*ptr++ = '\n';
+	/* append every set & selected glyph to the selection, growing the
+	 * buffer by the worst case of a line rather than of all of them */
+	linesiz = (term->col + 1) * UTF_SIZ;
+	for (y = term->sel.nb.y; y <= term->sel.ne.y; y++) {
+		if (siz - len < linesiz + 1) {
+			siz = 2 * siz + linesiz + 1;
+			str = xrealloc(str, siz);
+		}
+		if ((linelen = tlinelen(term, y)) == 0) {
+			str[len++] = '\n';
 			continue;
 		}
 
-		if (sel.type == SEL_RECTANGULAR) {
-			gp = &term.line[y][sel.nb.x];
-			lastx = sel.ne.x;
+		if (term->sel.type == SEL_RECTANGULAR) {
+			gp = &term->line[y][term->sel.nb.x];
+			lastx = term->sel.ne.x;
 		} else {
-			gp = &term.line[y][sel.nb.y == y ? sel.nb.x : 0];
-			lastx = (sel.ne.y == y) ? sel.ne.x : term.col-1;
+			gp = &term->line[y][term->sel.nb.y == y ? term->sel.nb.x : 0];
+			lastx = (term->sel.ne.y == y) ? term->sel.ne.x : term->col-1;
 		}
-		last = &term.line[y][MIN(lastx, linelen-1)];
+		last = &term->line[y][MIN(lastx, linelen-1)];
 		while (last >= gp && last->u == ' ')
 			--last;
 
 		for ( ; gp <= last; ++gp) {
-			if (gp->mode & ATTR_WDUMMY)
+			if (term->attrs[gp->a].mode & ATTR_WDUMMY)
 				continue;
 
-			ptr += utf8enc(gp->u, ptr);
+			len += utf8enc(gp->u, str + len);
 		}
 
 		/* Copy and pasting of line endings is inconsistent
@@ -441,22 +589,24 @@ getsel(void)
 		 * '\r', when something to be pasted is received by
 		 * st.
 		 * FIXME: Fix the computer world. */
-		if ((y < sel.ne.y || lastx >= linelen) &&
-		    (!(last->mode & ATTR_WRAP) || sel.type == SEL_RECTANGULAR))
-			*ptr++ = '\n';
+		if ((y < term->sel.ne.y || lastx >= linelen) &&
+		    (!(term->attrs[last->a].mode & ATTR_WRAP) ||
+		     term->sel.type == SEL_RECTANGULAR))
+			str[len++] = '\n';
 	}
-	*ptr = 0;
+	str = xrealloc(str, len + 1);
+	str[len] = '\0';
 	return str;
 }
 
 void
-selclear(void)
+selclear(Term *term)
 {
-	if (sel.ob.x == -1)
+	if (term->sel.ob.x == -1)
 		return;
-	sel.mode = SEL_IDLE;
-	sel.ob.x = -1;
-	tsetdirt(sel.nb.y, sel.ne.y);
+	term->sel.mode = SEL_IDLE;
+	term->sel.ob.x = -1;
+	tsetdirt(term, term->sel.nb.y, term->sel.ne.y);
 }
 
 void
@@ -514,20 +664,81 @@ execsh(char *cmd, char **args)
 void
 sigchld(int a)
 {
+	Term *t;
 	int stat;
 	pid_t p;
 
-	if ((p = waitpid(pid, &stat, WNOHANG)) < 0)
-		die("waiting for pid %hd failed: %s\n", pid, strerror(errno));
+	/* with -D_XOPEN_SOURCE, signal() has System V semantics and has
+	 * reset the handler; rearm it before reaping so no child is lost */
+	signal(SIGCHLD, sigchld);
+
+	/* terminals of st -d are closed with their shells still running,
+	 * see tfree() */
+	if (serving) {
+		while ((p = waitpid(-1, &stat, WNOHANG)) > 0) {
+			for (t = terms; t && t->pid != p; t = t->next)
+				;
+			if (t)
+				t->pid = 0;
+		}
+		return;
+	}
 
-	if (pid != p)
+	for (t = terms; t; t = t->next) {
+		if (t->pid <= 0)
+			continue;
+		if ((p = waitpid(t->pid, &stat, WNOHANG)) < 0)
+			die("waiting for pid %hd failed: %s\n", t->pid, strerror(errno));
+		if (p == t->pid)
+			break;
+	}
+	if (!t)
 		return;
 
+	/* with other terminals left, the frontend closes this one once its
+	 * tty hangs up; a replay ends once its tty has been read out. Else
+	 * ttyreap() exits, outside of the handler: a recording may be in the
+	 * middle of a write. */
+	t->pid = 0;
+	if (!closable() && t != playterm)
+		childstat = stat;
+}
+
+/* Whether the frontend closes a terminal whose tty hung up, rather than
+ * exiting with it */
+int
+closable(void)
+{
+	return terms->next || serving;
+}
+
+/* For st -d, which goes on with no terminals left. The handler is there
+ * before the first shell, which may be gone before ttynew() returns. */
+void
+ttyserve(void)
+{
+	serving = 1;
+	signal(SIGCHLD, sigchld);
+}
+
+/* Exit like the shell with status stat did */
+void
+childexit(int stat)
+{
 	if (WIFEXITED(stat) && WEXITSTATUS(stat))
 		die("child exited with status %d\n", WEXITSTATUS(stat));
 	else if (WIFSIGNALED(stat))
 		die("child terminated due to signal %d\n", WTERMSIG(stat));
-	_exit(0);
+	exit(0);
+}
+
+/* Exit once sigchld() has seen the shell of the last terminal go. The
+ * frontends call this from their main loop. */
+void
+ttyreap(void)
+{
+	if (childstat >= 0)
+		childexit(childstat);
 }
 
 void
@@ -555,23 +766,23 @@ stty(char **args)
 }
 
 int
-ttynew(const char *line, char *cmd, const char *out, char **args)
+ttynew(Term *term, const char *line, char *cmd, const char *out, char **args)
 {
 	int m, s;
 
 	if (out) {
-		term.mode |= MODE_PRINT;
+		term->mode |= MODE_PRINT;
 		iofd = (!strcmp(out, "-")) ? 1 : open(out, O_WRONLY | O_CREAT, 0666);
 		if (iofd < 0)
 			fprintf(stderr, "open '%s' failed: %s\n", out, strerror(errno));
 	}
 
 	if (line) {
-		if ((cmdfd = open(line, O_RDWR)) < 0)
+		if ((term->cmdfd = open(line, O_RDWR)) < 0)
 			die("open line '%s' failed: %s\n", line, strerror(errno));
-		dup2(cmdfd, 0);
+		dup2(term->cmdfd, 0);
 		stty(args);
-		return cmdfd;
+		return term->cmdfd;
 	}
 
 	/* openpty is BSD function, but it is implemented by glibc and
@@ -579,8 +790,10 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 	/* TODO: don't we essentially do a forkpty here? Let's use that instead */
 	if (openpty(&m, &s, NULL, NULL, NULL) < 0)
 		die("openpty failed: %s\n", strerror(errno));
+	/* not for the shells of the other terminals */
+	fcntl(m, F_SETFD, FD_CLOEXEC);
 
-	switch (pid = fork()) {
+	switch (term->pid = fork()) {
 	case -1:
 		die("fork failed: %s\n", strerror(errno));
 		break;
@@ -598,6 +811,8 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 		if (pledge("stdio getpw proc exec", NULL) == -1)
 			die("pledge failed\n");
 #endif
+		if (playfp)
+			replay();
 		execsh(cmd, args);
 		break;
 	default:
@@ -606,73 +821,402 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 			die("pledge failed\n");
 #endif
 		close(s);
-		cmdfd = m;
+		/* only the first terminal replays */
+		if (playfp) {
+			playterm = term;
+			fclose(playfp);
+			playfp = NULL;
+		}
+		term->cmdfd = m;
 		signal(SIGCHLD, sigchld);
 		break;
 	}
-	return cmdfd;
+	return term->cmdfd;
+}
+
+void
+ttyrecord(Term *term, const char *path)
+{
+	if (!(term->recfp = fopen(path, "w"))) {
+		fprintf(stderr, "open '%s' failed: %s\n", path, strerror(errno));
+		return;
+	}
+	setvbuf(term->recfp, NULL, _IOFBF, REC_BUF_SIZ);
+	clock_gettime(CLOCK_MONOTONIC, &term->recstart);
+
+	/* asciicast v2 header */
+	fprintf(term->recfp, "{\"version\": 2, \"width\": %d, \"height\": %d, "
+	        "\"timestamp\": %ld, \"env\": {\"TERM\": \"%s\"}}\n",
+	        term->col, term->row, (long)time(NULL), termname);
+}
+
+void
+recevent(Term *term, int type, const char *s, size_t n)
+{
+	struct timespec now;
+	const char *end = s + n;
+	size_t len;
+	Rune u;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(term->recfp, "[%.6f, \"%c\", \"", TIMEDIFF(now, term->recstart) / 1E3, type);
+	for (; s < end; s += len) {
+		len = 1;
+		switch (*s) {
+		case '"':
+		case '\\':
+			putc('\\', term->recfp);
+			putc(*s, term->recfp);
+			break;
+		case '\n':
+			fputs("\\n", term->recfp);
+			break;
+		case '\r':
+			fputs("\\r", term->recfp);
+			break;
+		default:
+			if (ISCONTROLC0(*s)) {
+				fprintf(term->recfp, "\\u%04x", *s);
+			} else if (!((uchar)*s & 0x80)) {
+				putc(*s, term->recfp);
+			} else if ((len = utf8dec(s, &u, end - s)) == 0 ||
+			           u == UTF_INVALID) {
+				/* the cast must stay valid UTF-8 */
+				fputs("\\ufffd", term->recfp);
+				len = 1;
+			} else {
+				fwrite(s, 1, len, term->recfp);
+			}
+			break;
+		}
+	}
+	fputs("\"]\n", term->recfp);
+}
+
+void
+ttyreplay(const char *path, int fast)
+{
+	if (!(playfp = fopen(path, "r")))
+		die("open '%s' failed: %s\n", path, strerror(errno));
+	playfast = fast;
+}
+
+char *
+freadline(FILE *fp, char **buf, size_t *siz)
+{
+	size_t n = 0;
+
+	do {
+		if (*siz - n < BUFSIZ)
+			*buf = xrealloc(*buf, *siz += BUFSIZ);
+		if (!fgets(*buf + n, *siz - n, fp))
+			return n ? *buf : NULL;
+		n += strlen(*buf + n);
+	} while ((*buf)[n - 1] != '\n');
+
+	return *buf;
+}
+
+void
+replay(void)
+{
+	struct termios tio;
+	struct timespec start, now, ts;
+	char *line = NULL;
+	size_t siz = 0, len;
+	double t, ms;
+
+	/* the recording holds the bytes as the pty master saw them */
+	if (tcgetattr(1, &tio) == 0) {
+		tio.c_oflag &= ~OPOST;
+		tio.c_lflag &= ~(ECHO|ICANON|ISIG|IEXTEN);
+		tcsetattr(1, TCSANOW, &tio);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (freadline(playfp, &line, &siz)) {
+		if (castdec(line, &t, &len) != 'o')
+			continue;
+		if (!playfast) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if ((ms = t * 1E3 - TIMEDIFF(now, start)) > 0) {
+				ts.tv_sec = ms / 1E3;
+				ts.tv_nsec = 1E6 * (ms - 1E3 * ts.tv_sec);
+				nanosleep(&ts, NULL);
+			}
+		}
+		if (xwrite(1, line, len) < 0)
+			_exit(1);
+	}
+
+	/* at full speed st quits once it has read everything, see
+	 * ttyread(); otherwise the last screen stays until the window is
+	 * closed */
+	if (!playfast)
+		for (;;)
+			pause();
+	_exit(0);
 }
 
 size_t
-ttyread(void)
+ttyread(Term *term)
 {
-	static char buf[BUFSIZ];
-	static int buflen = 0;
-	int ret, written;
+	char *buf = term->ttybuf;
+	int ret, written, stat;
+	pid_t pid;
+
+	if (term->sessfd > 0)
+		return sessread(term);
 
 	/* append read bytes to unprocessed bytes */
-	ret = read(cmdfd, buf+buflen, LEN(buf)-buflen);
+	ret = read(term->cmdfd, buf + term->ttybuflen,
+	           sizeof(term->ttybuf) - term->ttybuflen);
+
+	/* 0 tells the frontend that the tty hung up, as long as there are
+	 * other terminals left */
+	if (ret <= 0 && closable())
+		return 0;
 
 	switch (ret) {
+	case -1:
+		if (errno != EIO)
+			die("read from shell failed: %s\n", strerror(errno));
+		/* FALLTHROUGH */
 	case 0:
+		/* the other side of the pty is closed and all read; the
+		 * shell may be gone before sigchld() has seen it */
+		if (term == playterm)
+			exit(0);
+		if ((pid = term->pid) > 0) {
+			term->pid = 0; /* not for sigchld() to wait for */
+			if (waitpid(pid, &stat, 0) == pid)
+				childexit(stat);
+		}
+		ttyreap();
 		exit(0);
-	case -1:
-		die("read from shell failed: %s\n", strerror(errno));
 	default:
-		buflen += ret;
-		written = twrite(buf, buflen, 0);
-		buflen -= written;
+		term->ttybuflen += ret;
+		written = twrite(term, buf, term->ttybuflen, 0);
+		if (term->recfp)
+			recevent(term, 'o', buf, written);
+		term->ttybuflen -= written;
 		/* keep any incomplete UTF-8 byte sequence for the next call */
-		if (buflen > 0)
-			memmove(buf, buf + written, buflen);
+		if (term->ttybuflen > 0)
+			memmove(buf, buf + written, term->ttybuflen);
 		return ret;
 	}
 }
 
+/* The screen of an attached session is kept up to date by sts; keystrokes
+ * still go straight to the tty it handed over. */
+int
+ttyattach(Term *term, const char *name, char **args)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	char **argv;
+	pid_t pid;
+	int s, n, stat, tries;
+
+	strcpy(sa.sun_path, sockpath(name));
+	for (tries = 0;; tries++) {
+		if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			die("socket failed: %s\n", strerror(errno));
+		if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			break;
+		if (tries > 0)
+			die("connect to %s failed: %s\n", sa.sun_path,
+			    strerror(errno));
+		close(s);
+
+		/* no such session yet: sts returns once it is listening */
+		for (n = 0; args && args[n]; n++)
+			;
+		argv = xmalloc((n + 3) * sizeof(*argv));
+		argv[0] = "sts";
+		argv[1] = (char *)name;
+		memcpy(argv + 2, args, n * sizeof(*argv));
+		argv[n + 2] = NULL;
+		switch (pid = fork()) {
+		case -1:
+			die("fork failed: %s\n", strerror(errno));
+		case 0:
+			execvp(argv[0], argv);
+			die("exec %s failed: %s\n", argv[0], strerror(errno));
+		}
+		free(argv);
+		if (waitpid(pid, &stat, 0) < 0 || !WIFEXITED(stat) ||
+		    WEXITSTATUS(stat))
+			die("starting session '%s' failed\n", name);
+	}
+
+	if ((term->cmdfd = recvfd(s)) < 0)
+		die("no tty from session '%s'\n", name);
+	term->sessfd = s;
+	term->sessbuf = xmalloc(term->sessbufsiz = BUFSIZ);
+
+	return s;
+}
+
+size_t
+sessread(Term *term)
+{
+	SessMsg m;
+	size_t off;
+	int ret;
+
+	if (term->sessbufsiz - term->sessbuflen < BUFSIZ) {
+		term->sessbufsiz *= 2;
+		term->sessbuf = xrealloc(term->sessbuf, term->sessbufsiz);
+	}
+	ret = read(term->sessfd, term->sessbuf + term->sessbuflen,
+	           term->sessbufsiz - term->sessbuflen);
+
+	/* as for ttyread(), sts going away is the tty hanging up */
+	if (ret <= 0 && closable())
+		return 0;
+
+	switch (ret) {
+	case 0:
+		exit(0);
+	case -1:
+		die("read from session failed: %s\n", strerror(errno));
+	}
+
+	term->sessbuflen += ret;
+	for (off = 0; term->sessbuflen - off >= sizeof(m); off += m.len) {
+		memcpy(&m, term->sessbuf + off, sizeof(m));
+		if (term->sessbuflen - off - sizeof(m) < (size_t)m.len)
+			break;
+		off += sizeof(m);
+		sessmsg(term, m.type, term->sessbuf + off, m.len);
+	}
+	term->sessbuflen -= off;
+	memmove(term->sessbuf, term->sessbuf + off, term->sessbuflen);
+
+	return ret;
+}
+
+void
+sessmsg(Term *term, int type, char *p, size_t len)
+{
+	int a[2], x1, x2;
+	uint u[2];
+	size_t i, n;
+	SessGlyph sg;
+
+	switch (type) {
+	case SESS_LINE:
+		memcpy(a, p, sizeof(a));
+		n = (len - sizeof(a)) / sizeof(SessGlyph);
+		if (!BETWEEN(a[1], 0, term->row-1) || !BETWEEN(a[0], 0, term->col-1))
+			break;
+		n = MIN(n, (size_t)(term->col - a[0]));
+		for (i = 0; i < n; i++) {
+			memcpy(&sg, p + sizeof(a) + i * sizeof(sg), sizeof(sg));
+			term->line[a[1]][a[0] + i] =
+				(Glyph){ sg.u, tattr(term, &sg.a) };
+			tusecell(term, a[0] + i, a[1], &sg.a);
+		}
+		term->dirty[a[1]] = 1;
+		/* like tputc() does for a single cell */
+		if (selspan(term, a[1], &x1, &x2) && x1 < a[0] + (int)n &&
+		    x2 > a[0])
+			selclear(term);
+		break;
+	case SESS_CURSOR:
+		memcpy(a, p, sizeof(a));
+		tmoveto(term, a[0], a[1]);
+		break;
+	case SESS_MODE:
+		memcpy(u, p, sizeof(u));
+		xsetmode(0, u[1]);
+		xsetmode(1, u[0]);
+		break;
+	case SESS_TITLE:
+		xsettitle(*p ? p : NULL);
+		break;
+	case SESS_ICONTITLE:
+		xseticontitle(*p ? p : NULL);
+		break;
+	case SESS_BELL:
+		xbell();
+		break;
+	case SESS_SEL:
+		xsetsel(xstrdup(p));
+		break;
+	case SESS_COLOR:
+		memcpy(a, p, sizeof(int));
+		p += sizeof(int);
+		xsetcolorname(a[0], *p ? p : NULL);
+		break;
+	case SESS_COLORS:
+		xloadcolors();
+		break;
+	case SESS_CURSHAPE:
+		memcpy(a, p, sizeof(int));
+		xsetcursor(a[0]);
+		break;
+	case SESS_POINTER:
+		memcpy(a, p, sizeof(int));
+		xsetpointermotion(a[0]);
+		break;
+	case SESS_CLIPCOPY:
+		xclipcopy();
+		break;
+	case SESS_TTYMODE:
+		/* ttywrite() of the attached st looks at these */
+		memcpy(a, p, sizeof(int));
+		term->mode = (term->mode & ~(MODE_CRLF|MODE_ECHO)) | a[0];
+		break;
+	}
+}
+
 void
-ttywrite(const char *s, size_t n, int may_echo)
+ttywrite(Term *term, const char *s, size_t n, int may_echo)
 {
+	char buf[BUFSIZ];
 	const char *next;
+	size_t len, l;
 
 	if (may_echo && IS_SET(MODE_ECHO))
-		twrite(s, n, 1);
+		twrite(term, s, n, 1);
 
 	if (!IS_SET(MODE_CRLF)) {
-		ttywriteraw(s, n);
+		ttywriteraw(term, s, n);
 		return;
 	}
 
-	/* This is similar to how the kernel handles ONLCR for ttys */
-	while (n > 0) {
-		if (*s == '\r') {
-			next = s + 1;
-			ttywriteraw("\r\n", 2);
-		} else {
-			next = memchr(s, '\r', n);
-			DEFAULT(next, s + n);
-			ttywriteraw(s, next - s);
-		}
+	/* This is similar to how the kernel handles ONLCR for ttys. The
+	 * expanded text is gathered in buf, so that a paste of many short
+	 * lines doesn't turn into two tiny writes per line. */
+	for (len = 0; n > 0; ) {
+		next = memchr(s, '\r', n);
+		next = next ? next + 1 : s + n;
 		n -= next - s;
-		s = next;
+		while (s < next) {
+			if (len + 2 > sizeof(buf)) {
+				ttywriteraw(term, buf, len);
+				len = 0;
+			}
+			l = MIN((size_t)(next - s), sizeof(buf) - 1 - len);
+			memcpy(buf + len, s, l);
+			len += l;
+			s += l;
+		}
+		if (next[-1] == '\r')
+			buf[len++] = '\n';
 	}
+	if (len > 0)
+		ttywriteraw(term, buf, len);
 }
 
 void
-ttywriteraw(const char *s, size_t n)
+ttywriteraw(Term *term, const char *s, size_t n)
 {
 	fd_set wfd, rfd;
 	ssize_t r;
 	size_t lim = 256;
+	int rd = term->sessfd > 0 ? term->sessfd : term->cmdfd;
 
 	/* Remember that we are using a pty, which might be a modem line. Writing
 	 * too much will clog the line. That's why we are doing this dance.
@@ -680,26 +1224,26 @@ ttywriteraw(const char *s, size_t n)
 	while (n > 0) {
 		FD_ZERO(&wfd);
 		FD_ZERO(&rfd);
-		FD_SET(cmdfd, &wfd);
-		FD_SET(cmdfd, &rfd);
+		FD_SET(term->cmdfd, &wfd);
+		FD_SET(rd, &rfd);
 
 		/* Check if we can write. */
-		if (pselect(cmdfd+1, &rfd, &wfd, NULL, NULL, NULL) < 0) {
+		if (pselect(MAX(term->cmdfd, rd)+1, &rfd, &wfd, NULL, NULL, NULL) < 0) {
 			if (errno == EINTR)
 				continue;
 			die("select failed: %s\n", strerror(errno));
 		}
-		if (FD_ISSET(cmdfd, &wfd)) {
+		if (FD_ISSET(term->cmdfd, &wfd)) {
 			/* Only write the bytes written by ttywrite() or the
 			 * default of 256. This seems to be a reasonable value
 			 * for a serial line. Bigger values might clog the I/O. */
-			if ((r = write(cmdfd, s, (n < lim)? n : lim)) < 0)
+			if ((r = write(term->cmdfd, s, (n < lim)? n : lim)) < 0)
 				goto write_error;
 			if (r < n) {
 				/* We weren't able to write out everything. This means the
 				 * buffer is getting full again. Empty it. */
-				if (n < lim)
-					lim = ttyread();
+				if (n < lim && (lim = ttyread(term)) == 0)
+					return;
 				n -= r;
 				s += r;
 			} else {
@@ -707,43 +1251,73 @@ ttywriteraw(const char *s, size_t n)
 				break;
 			}
 		}
-		if (FD_ISSET(cmdfd, &rfd))
-			lim = ttyread();
+		/* a hung up tty is closed by the frontend */
+		if (FD_ISSET(rd, &rfd) && (lim = ttyread(term)) == 0)
+			return;
 	}
 	return;
 
 write_error:
+	if (errno == EIO && closable())
+		return; /* hung up, as above */
 	die("write on tty failed: %s\n", strerror(errno));
 }
 
 void
-ttyresize(int tw, int th)
+ttyresize(Term *term, int tw, int th)
 {
 	struct winsize w;
+	char buf[32];
+	int len;
 
-	w.ws_row = term.row;
-	w.ws_col = term.col;
+	/* sts resizes the tty once its terminal has been resized */
+	if (term->sessfd > 0) {
+		SessMsg m = { SESS_RESIZE, 4 * sizeof(int) };
+		int a[4] = { term->col, term->row, tw, th };
+
+		memcpy(buf, &m, sizeof(m));
+		memcpy(buf + sizeof(m), a, sizeof(a));
+		if (xwrite(term->sessfd, buf, sizeof(m) + sizeof(a)) < 0)
+			fprintf(stderr, "write to session failed: %s\n",
+			        strerror(errno));
+		return;
+	}
+
+	w.ws_row = term->row;
+	w.ws_col = term->col;
 	w.ws_xpixel = tw;
 	w.ws_ypixel = th;
-	if (ioctl(cmdfd, TIOCSWINSZ, &w) < 0)
+	if (ioctl(term->cmdfd, TIOCSWINSZ, &w) < 0)
 		fprintf(stderr, "failed to set window size: %s\n", strerror(errno));
+	if (term->recfp) {
+		len = snprintf(buf, sizeof(buf), "%dx%d", term->col, term->row);
+		recevent(term, 'r', buf, len);
+	}
 }
 
 void
-ttyhangup()
+ttyhangup(Term *term)
 {
-	/* Send SIGHUP to shell */
-	kill(pid, SIGHUP);
+	/* Send SIGHUP to shell, unless it belongs to a session */
+	if (term->pid > 0)
+		kill(term->pid, SIGHUP);
 }
 
+/* The modes ttywrite() depends on, for sts to pass them on */
 int
-tattrset(int attr)
+ttymode(Term *term)
+{
+	return term->mode & (MODE_CRLF|MODE_ECHO);
+}
+
+int
+tattrset(Term *term, int attr)
 {
 	int i, j;
 
-	for (i = 0; i < term.row-1; i++) {
-		for (j = 0; j < term.col-1; j++) {
-			if (term.line[i][j].mode & attr)
+	for (i = 0; i < term->row-1; i++) {
+		for (j = 0; j < term->col-1; j++) {
+			if (term->attrs[term->line[i][j].a].mode & attr)
 				return 1;
 		}
 	}
@@ -752,26 +1326,73 @@ tattrset(int attr)
 }
 
 void
-tsetdirt(int top, int bot)
+tsetdirt(Term *term, int top, int bot)
 {
 	int i;
 
-	LIMIT(top, 0, term.row-1);
-	LIMIT(bot, 0, term.row-1);
+	LIMIT(top, 0, term->row-1);
+	LIMIT(bot, 0, term->row-1);
 
 	for (i = top; i <= bot; i++)
-		term.dirty[i] = 1;
+		term->dirty[i] = 1;
 }
 
+/* Lines showing palette color i, which x.c draws instead of colors 0 to 7
+ * in bold text as well. The default colors show everywhere. */
 void
-tsetdirtattr(int attr)
+tsetdirtcolor(Term *term, int i)
+{
+	int y;
+
+	/* the cursor colors are not recorded with the lines */
+	if (i == defaultfg || i == defaultbg || i == defaultattr ||
+	    i == defaultcs || i == defaultrcs) {
+		tfulldirt(term);
+		return;
+	}
+	if (!BETWEEN(i, 0, 255))
+		return;
+
+	for (y = 0; y < term->row; y++) {
+		if (term->info[y].colors[i / 32] & 1U << i % 32)
+			term->dirty[y] = 1;
+	}
+}
+
+/* Record the palette colors of attributes g, written to line y */
+void
+tusecolor(Term *term, int y, const Attr *g)
+{
+	uint32_t *bits = term->info[y].colors;
+
+	if (g->fg < 256) {
+		bits[g->fg / 32] |= 1U << g->fg % 32;
+		/* x.c may draw bold text in the bright version */
+		if (g->fg < 8 && g->mode & ATTR_BOLD)
+			bits[0] |= 1U << (g->fg + 8);
+	}
+	if (g->bg < 256)
+		bits[g->bg / 32] |= 1U << g->bg % 32;
+}
+
+/* Record glyph x of line y, with attributes g, as written */
+void
+tusecell(Term *term, int x, int y, const Attr *g)
+{
+	if (term->info[y].len <= x)
+		term->info[y].len = x + 1;
+	tusecolor(term, y, g);
+}
+
+void
+tsetdirtattr(Term *term, int attr)
 {
 	int i, j;
 
-	for (i = 0; i < term.row-1; i++) {
-		for (j = 0; j < term.col-1; j++) {
-			if (term.line[i][j].mode & attr) {
-				tsetdirt(i, i);
+	for (i = 0; i < term->row-1; i++) {
+		for (j = 0; j < term->col-1; j++) {
+			if (term->attrs[term->line[i][j].a].mode & attr) {
+				tsetdirt(term, i, i);
 				break;
 			}
 		}
@@ -779,199 +1400,368 @@ tsetdirtattr(int attr)
 }
 
 void
-tfulldirt(void)
+tfulldirt(Term *term)
 {
-	tsetdirt(0, term.row-1);
+	tsetdirt(term, 0, term->row-1);
 }
 
 void
-tcursor(int mode)
+tcursor(Term *term, int mode)
 {
-	static TCursor c[2];
-	int alt = IS_SET(MODE_ALTSCREEN);
+	TCursor *c = &term->sc[IS_SET(MODE_ALTSCREEN)];
 
 	if (mode == CURSOR_SAVE) {
-		c[alt] = term.c;
+		*c = term->c;
 	} else if (mode == CURSOR_LOAD) {
-		term.c = c[alt];
-		tmoveto(c[alt].x, c[alt].y);
+		term->c = *c;
+		tmoveto(term, c->x, c->y);
 	}
 }
 
 void
-treset(void)
+treset(Term *term)
 {
 	uint i;
 
-	term.c = (TCursor){{
+	term->c = (TCursor){{
 		.mode = ATTR_NULL,
 		.fg = defaultfg,
 		.bg = defaultbg
 	}, .x = 0, .y = 0, .state = CURSOR_DEFAULT};
 
-	memset(term.tabs, 0, term.col * sizeof(*term.tabs));
-	for (i = tabspaces; i < term.col; i += tabspaces)
-		term.tabs[i] = 1;
-	term.top = 0;
-	term.bot = term.row - 1;
-	term.mode = MODE_WRAP|MODE_UTF8;
-	memset(term.trantbl, CS_USA, sizeof(term.trantbl));
-	term.charset = 0;
+	memset(term->tabs, 0, term->col * sizeof(*term->tabs));
+	for (i = tabspaces; i < term->col; i += tabspaces)
+		term->tabs[i] = 1;
+	term->top = 0;
+	term->bot = term->row - 1;
+	term->mode = MODE_WRAP|MODE_UTF8;
+	memset(term->trantbl, CS_USA, sizeof(term->trantbl));
+	term->charset = 0;
 
 	for (i = 0; i < 2; i++) {
-		tmoveto(0, 0);
-		tcursor(CURSOR_SAVE);
-		tclearregion(0, 0, term.col-1, term.row-1);
-		tswapscreen();
+		tmoveto(term, 0, 0);
+		tcursor(term, CURSOR_SAVE);
+		tclearregion(term, 0, 0, term->col-1, term->row-1);
+		tswapscreen(term);
 	}
 }
 
-void
+Term *
 tnew(int col, int row)
 {
-	term = (Term){ .c = { .attr = { .fg = defaultfg, .bg = defaultbg } } };
-	tresize(col, row);
-	treset();
+	Term *term = xmalloc(sizeof(*term));
+
+	delimsinit();
+	*term = (Term){ .c = { .attr = { .fg = defaultfg, .bg = defaultbg } } };
+	term->next = terms;
+	terms = term;
+	tresize(term, col, row);
+	treset(term);
+	selinit(term);
+
+	return term;
+}
+
+void
+tfree(Term *term)
+{
+	Term **tp;
+	int i;
+
+	for (tp = &terms; *tp != term; tp = &(*tp)->next)
+		;
+	*tp = term->next;
+	if (term == playterm)
+		playterm = NULL;
+
+	if (term->pid > 0)
+		kill(term->pid, SIGHUP);
+	if (term->cmdfd > 0)
+		close(term->cmdfd);
+	if (term->sessfd > 0)
+		close(term->sessfd);
+	if (term->recfp)
+		fclose(term->recfp);
+	for (i = 0; i < term->row; i++) {
+		free(term->line[i]);
+		free(term->alt[i]);
+	}
+	free(term->line);
+	free(term->alt);
+	free(term->info);
+	free(term->altinfo);
+	free(term->dirty);
+	free(term->query);
+	free(term->hit);
+	free(term->sig);
+	free(term->hl);
+	free(term->tabs);
+	free(term->attrs);
+	free(term->attrtab);
+	free(term->strescseq.buf);
+	free(term->sessbuf);
+	free(term);
 }
 
 void
-tswapscreen(void)
+tswapscreen(Term *term)
 {
-	Line *tmp = term.line;
+	Line *tmp = term->line;
+	Lineinfo *itmp = term->info;
 
-	term.line = term.alt;
-	term.alt = tmp;
-	term.mode ^= MODE_ALTSCREEN;
-	tfulldirt();
+	term->line = term->alt;
+	term->alt = tmp;
+	term->info = term->altinfo;
+	term->altinfo = itmp;
+	term->mode ^= MODE_ALTSCREEN;
+	tfulldirt(term);
 }
 
 void
-tscrolldown(int orig, int n)
+tscrolldown(Term *term, int orig, int n)
 {
 	int i;
 	Line temp;
+	Lineinfo itemp;
 
-	LIMIT(n, 0, term.bot-orig+1);
+	LIMIT(n, 0, term->bot-orig+1);
 
-	tsetdirt(orig, term.bot-n);
-	tclearregion(0, term.bot-n+1, term.col-1, term.bot);
+	tsetdirt(term, orig, term->bot-n);
+	tclearregion(term, 0, term->bot-n+1, term->col-1, term->bot);
 
-	for (i = term.bot; i >= orig+n; i--) {
-		temp = term.line[i];
-		term.line[i] = term.line[i-n];
-		term.line[i-n] = temp;
+	for (i = term->bot; i >= orig+n; i--) {
+		temp = term->line[i];
+		term->line[i] = term->line[i-n];
+		term->line[i-n] = temp;
+		itemp = term->info[i];
+		term->info[i] = term->info[i-n];
+		term->info[i-n] = itemp;
 	}
 
-	selscroll(orig, n);
+	selscroll(term, orig, n);
 }
 
 void
-tscrollup(int orig, int n)
+tscrollup(Term *term, int orig, int n)
 {
 	int i;
 	Line temp;
+	Lineinfo itemp;
 
-	LIMIT(n, 0, term.bot-orig+1);
+	LIMIT(n, 0, term->bot-orig+1);
 
-	tclearregion(0, orig, term.col-1, orig+n-1);
-	tsetdirt(orig+n, term.bot);
+	tclearregion(term, 0, orig, term->col-1, orig+n-1);
+	tsetdirt(term, orig+n, term->bot);
 
-	for (i = orig; i <= term.bot-n; i++) {
-		temp = term.line[i];
-		term.line[i] = term.line[i+n];
-		term.line[i+n] = temp;
+	for (i = orig; i <= term->bot-n; i++) {
+		temp = term->line[i];
+		term->line[i] = term->line[i+n];
+		term->line[i+n] = temp;
+		itemp = term->info[i];
+		term->info[i] = term->info[i+n];
+		term->info[i+n] = itemp;
 	}
 
-	selscroll(orig, -n);
+	selscroll(term, orig, -n);
 }
 
 void
-selscroll(int orig, int n)
+selscroll(Term *term, int orig, int n)
 {
-	if (sel.ob.x == -1)
+	if (term->sel.ob.x == -1)
 		return;
 
-	if (BETWEEN(sel.nb.y, orig, term.bot) != BETWEEN(sel.ne.y, orig, term.bot)) {
-		selclear();
-	} else if (BETWEEN(sel.nb.y, orig, term.bot)) {
-		sel.ob.y += n;
-		sel.oe.y += n;
-		if (sel.ob.y < term.top || sel.ob.y > term.bot ||
-				sel.oe.y < term.top || sel.oe.y > term.bot)
-			selclear();
+	if (BETWEEN(term->sel.nb.y, orig, term->bot) != BETWEEN(term->sel.ne.y, orig, term->bot)) {
+		selclear(term);
+	} else if (BETWEEN(term->sel.nb.y, orig, term->bot)) {
+		term->sel.ob.y += n;
+		term->sel.oe.y += n;
+		if (term->sel.ob.y < term->top || term->sel.ob.y > term->bot ||
+				term->sel.oe.y < term->top || term->sel.oe.y > term->bot)
+			selclear(term);
 		else
-			selnormalize();
+			selnormalize(term);
 	}
 }
 
 void
-tnewline(int first_col)
+tnewline(Term *term, int first_col)
 {
-	int y = term.c.y;
+	int y = term->c.y;
 
-	if (y == term.bot)
-		tscrollup(term.top, 1);
+	if (y == term->bot)
+		tscrollup(term, term->top, 1);
 	else
 		y++;
-	tmoveto(first_col ? 0 : term.c.x, y);
+	tmoveto(term, first_col ? 0 : term->c.x, y);
 }
 
 void
-csiparse(void)
+csiparse(Term *term)
 {
-	char *p = csiescseq.buf, *np;
+	char *p = term->csiescseq.buf, *np;
 	long int v;
 
-	csiescseq.narg = 0;
+	term->csiescseq.narg = 0;
 	if (*p == '?') {
-		csiescseq.priv = 1;
+		term->csiescseq.priv = 1;
 		p++;
 	}
 
-	csiescseq.buf[csiescseq.len] = '\0';
-	while (p < csiescseq.buf+csiescseq.len) {
+	term->csiescseq.buf[term->csiescseq.len] = '\0';
+	while (p < term->csiescseq.buf+term->csiescseq.len) {
 		np = NULL;
 		v = strtol(p, &np, 10);
 		if (np == p)
 			v = 0;
 		if (v == LONG_MAX || v == LONG_MIN)
 			v = -1;
-		csiescseq.arg[csiescseq.narg++] = v;
+		term->csiescseq.arg[term->csiescseq.narg++] = v;
 		p = np;
-		if (*p != ';' || csiescseq.narg == ESC_ARG_SIZ)
+		if (*p != ';' || term->csiescseq.narg == ESC_ARG_SIZ)
 			break;
 		p++;
 	}
-	csiescseq.mode[0] = *p++;
-	csiescseq.mode[1] = (p < csiescseq.buf+csiescseq.len) ? *p : '\0';
+	term->csiescseq.mode[0] = *p++;
+	term->csiescseq.mode[1] = (p < term->csiescseq.buf+term->csiescseq.len) ? *p : '\0';
 }
 
 /* for absolute user moves, when decom is set */
 void
-tmoveato(int x, int y)
+tmoveato(Term *term, int x, int y)
 {
-	tmoveto(x, y + ((term.c.state & CURSOR_ORIGIN) ? term.top: 0));
+	tmoveto(term, x, y + ((term->c.state & CURSOR_ORIGIN) ? term->top: 0));
 }
 
 void
-tmoveto(int x, int y)
+tmoveto(Term *term, int x, int y)
 {
 	int miny, maxy;
 
-	if (term.c.state & CURSOR_ORIGIN) {
-		miny = term.top;
-		maxy = term.bot;
+	if (term->c.state & CURSOR_ORIGIN) {
+		miny = term->top;
+		maxy = term->bot;
 	} else {
 		miny = 0;
-		maxy = term.row - 1;
+		maxy = term->row - 1;
+	}
+	term->c.state &= ~CURSOR_WRAPNEXT;
+	term->c.x = LIMIT(x, 0, term->col-1);
+	term->c.y = LIMIT(y, miny, maxy);
+}
+
+/* Index of attributes a in the attrs of term, where they are added unless
+ * already there. Only glyphs may hold on to indices: attrgc() renumbers
+ * them. */
+uint32_t
+tattr(Term *term, const Attr *a)
+{
+	uint32_t h, i, mask;
+
+	if (term->attrlast < term->attrlen &&
+	    ATTREQ(term->attrs[term->attrlast], *a))
+		return term->attrlast;
+	if (term->attrlen == term->attrcap) /* full, or not set up yet */
+		attrgc(term);
+
+	mask = 2 * term->attrcap - 1;
+	for (h = attrkey(a) & mask; (i = term->attrtab[h]) != UINT32_MAX;
+	     h = (h + 1) & mask) {
+		if (ATTREQ(term->attrs[i], *a))
+			return term->attrlast = i;
 	}
-	term.c.state &= ~CURSOR_WRAPNEXT;
-	term.c.x = LIMIT(x, 0, term.col-1);
-	term.c.y = LIMIT(y, miny, maxy);
+	term->attrs[term->attrlen] = *a;
+	term->attrtab[h] = term->attrlen;
+	return term->attrlast = term->attrlen++;
+}
+
+uint32_t
+attrkey(const Attr *a)
+{
+	uint32_t h;
+
+	h = a->mode * 0x9e3779b1U ^ a->fg * 0x85ebca6bU ^ a->bg * 0xc2b2ae35U;
+	return h ^ h >> 16;
+}
+
+/* Drop the attributes no glyph of term refers to anymore, and make room for
+ * more when most of them are in use. attrs[0] are the defaults, so that
+ * zeroed glyphs are blanks. */
+void
+attrgc(Term *term)
+{
+	Glyph *l, *g, *end;
+	uint32_t *map, i, n, h, mask;
+	int s;
+
+	if (term->attrlen > 0) {
+		map = xmalloc(term->attrlen * sizeof(*map));
+		memset(map, 0, term->attrlen * sizeof(*map));
+		map[0] = 1;
+		for (s = 0; s < 2 * term->row; s++) {
+			l = (s < term->row) ? term->line[s]
+			                    : term->alt[s - term->row];
+			for (g = l, end = g + term->col; g < end; g++)
+				map[g->a] = 1;
+		}
+		for (i = n = 0; i < term->attrlen; i++) {
+			if (map[i]) {
+				term->attrs[n] = term->attrs[i];
+				map[i] = n++;
+			}
+		}
+		for (s = 0; s < 2 * term->row; s++) {
+			l = (s < term->row) ? term->line[s]
+			                    : term->alt[s - term->row];
+			for (g = l, end = g + term->col; g < end; g++)
+				g->a = map[g->a];
+		}
+		free(map);
+		term->attrlen = n;
+	}
+
+	if (2 * term->attrlen >= term->attrcap) {
+		term->attrcap = MAX(2 * term->attrcap, 256);
+		term->attrs = xrealloc(term->attrs,
+		                       term->attrcap * sizeof(*term->attrs));
+		term->attrtab = xrealloc(term->attrtab,
+		                         2 * term->attrcap * sizeof(*term->attrtab));
+	}
+	if (term->attrlen == 0) {
+		term->attrs[term->attrlen++] =
+			(Attr){ ATTR_NULL, defaultfg, defaultbg };
+	}
+
+	mask = 2 * term->attrcap - 1;
+	memset(term->attrtab, 0xff, 2 * term->attrcap * sizeof(*term->attrtab));
+	for (i = 0; i < term->attrlen; i++) {
+		for (h = attrkey(&term->attrs[i]) & mask;
+		     term->attrtab[h] != UINT32_MAX; h = (h + 1) & mask)
+			;
+		term->attrtab[h] = i;
+	}
+}
+
+/* The attributes the glyphs of term are indices into. The frontend must not
+ * keep the pointer past the next write to term. */
+const Attr *
+tattrs(Term *term)
+{
+	return term->attrs;
+}
+
+/* Set and clear attribute flags of a single glyph */
+void
+glyphmode(Term *term, Glyph *g, int set, int clr)
+{
+	Attr a = term->attrs[g->a];
+
+	a.mode = (a.mode | set) & ~clr;
+	g->a = tattr(term, &a);
 }
 
 void
-tsetchar(Rune u, const Glyph *attr, int x, int y)
+tsetchar(Term *term, Rune u, const Attr *attr, int x, int y)
 {
 	static const char *vt100_0[62] = { /* 0x41 - 0x7e */
 		"↑", "↓", "→", "←", "█", "▚", "☃", /* A - G */
@@ -985,101 +1775,117 @@ tsetchar(Rune u, const Glyph *attr, int x, int y)
 	};
 
 	/* The table is proudly stolen from rxvt. */
-	if (term.trantbl[term.charset] == CS_GRAPHIC0 &&
+	if (term->trantbl[term->charset] == CS_GRAPHIC0 &&
 			BETWEEN(u, 0x41, 0x7e) && vt100_0[u - 0x41])
 		utf8dec(vt100_0[u - 0x41], &u, UTF_SIZ);
 
-	if (term.line[y][x].mode & ATTR_WIDE) {
-		if (x+1 < term.col) {
-			term.line[y][x+1].u = ' ';
-			term.line[y][x+1].mode &= ~ATTR_WDUMMY;
+	if (term->attrs[term->line[y][x].a].mode & ATTR_WIDE) {
+		if (x+1 < term->col) {
+			term->line[y][x+1].u = ' ';
+			glyphmode(term, &term->line[y][x+1], 0, ATTR_WDUMMY);
 		}
-	} else if (term.line[y][x].mode & ATTR_WDUMMY) {
-		term.line[y][x-1].u = ' ';
-		term.line[y][x-1].mode &= ~ATTR_WIDE;
+	} else if (term->attrs[term->line[y][x].a].mode & ATTR_WDUMMY) {
+		term->line[y][x-1].u = ' ';
+		glyphmode(term, &term->line[y][x-1], 0, ATTR_WIDE);
 	}
 
-	term.dirty[y] = 1;
-	term.line[y][x] = *attr;
-	term.line[y][x].u = u;
+	term->dirty[y] = 1;
+	term->line[y][x] = (Glyph){ u, tattr(term, attr) };
+	tusecell(term, x, y, attr);
 }
 
 void
-tclearregion(int x1, int y1, int x2, int y2)
+tclearregion(Term *term, int x1, int y1, int x2, int y2)
 {
-	int x, y, temp;
+	int x, y, temp, sx1, sx2;
+	size_t len;
 	Glyph *gp;
+	Attr fill = { .fg = term->c.attr.fg, .bg = term->c.attr.bg };
 
 	if (x1 > x2)
 		temp = x1, x1 = x2, x2 = temp;
 	if (y1 > y2)
 		temp = y1, y1 = y2, y2 = temp;
 
-	LIMIT(x1, 0, term.col-1);
-	LIMIT(x2, 0, term.col-1);
-	LIMIT(y1, 0, term.row-1);
-	LIMIT(y2, 0, term.row-1);
+	LIMIT(x1, 0, term->col-1);
+	LIMIT(x2, 0, term->col-1);
+	LIMIT(y1, 0, term->row-1);
+	LIMIT(y2, 0, term->row-1);
 
 	for (y = y1; y <= y2; y++) {
-		term.dirty[y] = 1;
-		for (x = x1; x <= x2; x++) {
-			gp = &term.line[y][x];
-			if (selected(x, y))
-				selclear();
-			gp->fg = term.c.attr.fg;
-			gp->bg = term.c.attr.bg;
-			gp->mode = 0;
-			gp->u = ' ';
+		if (selspan(term, y, &sx1, &sx2) && sx1 <= x2 && sx2 > x1) {
+			selclear(term);
+			break;
 		}
 	}
+
+	/* the first line is the template of the others */
+	gp = &term->line[y1][x1];
+	gp[0] = (Glyph){ ' ', tattr(term, &fill) };
+	for (x = 1; x <= x2 - x1; x++)
+		gp[x] = gp[0];
+	len = (x2 - x1 + 1) * sizeof(Glyph);
+	for (y = y1; y <= y2; y++) {
+		if (y > y1)
+			memcpy(&term->line[y][x1], gp, len);
+		term->dirty[y] = 1;
+		if (x1 == 0 && x2 == term->col-1)
+			memset(term->info[y].colors, 0, sizeof(term->info[y].colors));
+		if (term->info[y].len <= x2 + 1)
+			term->info[y].len = MIN(term->info[y].len, x1);
+		tusecolor(term, y, &fill);
+	}
 }
 
 void
-tdeletechar(int n)
+tdeletechar(Term *term, int n)
 {
 	int dst, src, size;
 	Glyph *line;
 
-	LIMIT(n, 0, term.col - term.c.x);
+	LIMIT(n, 0, term->col - term->c.x);
 
-	dst = term.c.x;
-	src = term.c.x + n;
-	size = term.col - src;
-	line = term.line[term.c.y];
+	dst = term->c.x;
+	src = term->c.x + n;
+	size = term->col - src;
+	line = term->line[term->c.y];
 
 	memmove(&line[dst], &line[src], size * sizeof(Glyph));
-	tclearregion(term.col-n, term.c.y, term.col-1, term.c.y);
+	tclearregion(term, term->col-n, term->c.y, term->col-1, term->c.y);
 }
 
 void
-tinsertblank(int n)
+tinsertblank(Term *term, int n)
 {
 	int dst, src, size;
 	Glyph *line;
+	Lineinfo *info;
 
-	LIMIT(n, 0, term.col - term.c.x);
+	LIMIT(n, 0, term->col - term->c.x);
 
-	dst = term.c.x + n;
-	src = term.c.x;
-	size = term.col - dst;
-	line = term.line[term.c.y];
+	dst = term->c.x + n;
+	src = term->c.x;
+	size = term->col - dst;
+	line = term->line[term->c.y];
+	info = &term->info[term->c.y];
 
 	memmove(&line[dst], &line[src], size * sizeof(Glyph));
-	tclearregion(src, term.c.y, dst - 1, term.c.y);
+	info->len = MIN(info->len + n, term->col);
+	tclearregion(term, src, term->c.y, dst - 1, term->c.y);
 }
 
 void
-tinsertblankline(int n)
+tinsertblankline(Term *term, int n)
 {
-	if (BETWEEN(term.c.y, term.top, term.bot))
-		tscrolldown(term.c.y, n);
+	if (BETWEEN(term->c.y, term->top, term->bot))
+		tscrolldown(term, term->c.y, n);
 }
 
 void
-tdeleteline(int n)
+tdeleteline(Term *term, int n)
 {
-	if (BETWEEN(term.c.y, term.top, term.bot))
-		tscrollup(term.c.y, n);
+	if (BETWEEN(term->c.y, term->top, term->bot))
+		tscrollup(term, term->c.y, n);
 }
 
 int32_t
@@ -1131,7 +1937,7 @@ tdefcolor(const int *attr, int *npar, int l)
 }
 
 void
-tsetattr(const int *attr, int l)
+tsetattr(Term *term, const int *attr, int l)
 {
 	int i;
 	int32_t idx;
@@ -1139,7 +1945,7 @@ tsetattr(const int *attr, int l)
 	for (i = 0; i < l; i++) {
 		switch (attr[i]) {
 		case 0:
-			term.c.attr.mode &= ~(
+			term->c.attr.mode &= ~(
 				ATTR_BOLD       |
 				ATTR_FAINT      |
 				ATTR_ITALIC     |
@@ -1148,84 +1954,84 @@ tsetattr(const int *attr, int l)
 				ATTR_REVERSE    |
 				ATTR_INVISIBLE  |
 				ATTR_STRUCK     );
-			term.c.attr.fg = defaultfg;
-			term.c.attr.bg = defaultbg;
+			term->c.attr.fg = defaultfg;
+			term->c.attr.bg = defaultbg;
 			break;
 		case 1:
-			term.c.attr.mode |= ATTR_BOLD;
+			term->c.attr.mode |= ATTR_BOLD;
 			break;
 		case 2:
-			term.c.attr.mode |= ATTR_FAINT;
+			term->c.attr.mode |= ATTR_FAINT;
 			break;
 		case 3:
-			term.c.attr.mode |= ATTR_ITALIC;
+			term->c.attr.mode |= ATTR_ITALIC;
 			break;
 		case 4:
-			term.c.attr.mode |= ATTR_UNDERLINE;
+			term->c.attr.mode |= ATTR_UNDERLINE;
 			break;
 		case 5: /* slow blink */
 			/* FALLTHROUGH */
 		case 6: /* rapid blink */
-			term.c.attr.mode |= ATTR_BLINK;
+			term->c.attr.mode |= ATTR_BLINK;
 			break;
 		case 7:
-			term.c.attr.mode |= ATTR_REVERSE;
+			term->c.attr.mode |= ATTR_REVERSE;
 			break;
 		case 8:
-			term.c.attr.mode |= ATTR_INVISIBLE;
+			term->c.attr.mode |= ATTR_INVISIBLE;
 			break;
 		case 9:
-			term.c.attr.mode |= ATTR_STRUCK;
+			term->c.attr.mode |= ATTR_STRUCK;
 			break;
 		case 22:
-			term.c.attr.mode &= ~(ATTR_BOLD | ATTR_FAINT);
+			term->c.attr.mode &= ~(ATTR_BOLD | ATTR_FAINT);
 			break;
 		case 23:
-			term.c.attr.mode &= ~ATTR_ITALIC;
+			term->c.attr.mode &= ~ATTR_ITALIC;
 			break;
 		case 24:
-			term.c.attr.mode &= ~ATTR_UNDERLINE;
+			term->c.attr.mode &= ~ATTR_UNDERLINE;
 			break;
 		case 25:
-			term.c.attr.mode &= ~ATTR_BLINK;
+			term->c.attr.mode &= ~ATTR_BLINK;
 			break;
 		case 27:
-			term.c.attr.mode &= ~ATTR_REVERSE;
+			term->c.attr.mode &= ~ATTR_REVERSE;
 			break;
 		case 28:
-			term.c.attr.mode &= ~ATTR_INVISIBLE;
+			term->c.attr.mode &= ~ATTR_INVISIBLE;
 			break;
 		case 29:
-			term.c.attr.mode &= ~ATTR_STRUCK;
+			term->c.attr.mode &= ~ATTR_STRUCK;
 			break;
 		case 38:
 			if ((idx = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.fg = idx;
+				term->c.attr.fg = idx;
 			break;
 		case 39:
-			term.c.attr.fg = defaultfg;
+			term->c.attr.fg = defaultfg;
 			break;
 		case 48:
 			if ((idx = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.bg = idx;
+				term->c.attr.bg = idx;
 			break;
 		case 49:
-			term.c.attr.bg = defaultbg;
+			term->c.attr.bg = defaultbg;
 			break;
 		default:
 			if (BETWEEN(attr[i], 30, 37)) {
-				term.c.attr.fg = attr[i] - 30;
+				term->c.attr.fg = attr[i] - 30;
 			} else if (BETWEEN(attr[i], 40, 47)) {
-				term.c.attr.bg = attr[i] - 40;
+				term->c.attr.bg = attr[i] - 40;
 			} else if (BETWEEN(attr[i], 90, 97)) {
-				term.c.attr.fg = attr[i] - 90 + 8;
+				term->c.attr.fg = attr[i] - 90 + 8;
 			} else if (BETWEEN(attr[i], 100, 107)) {
-				term.c.attr.bg = attr[i] - 100 + 8;
+				term->c.attr.bg = attr[i] - 100 + 8;
 			} else {
 				fprintf(stderr,
 						"erresc(default): gfx attr %d unknown\n",
 						attr[i]);
-				csidump();
+				csidump(term);
 			}
 			break;
 		}
@@ -1233,23 +2039,23 @@ tsetattr(const int *attr, int l)
 }
 
 void
-tsetscroll(int t, int b)
+tsetscroll(Term *term, int t, int b)
 {
 	int temp;
 
-	LIMIT(t, 0, term.row-1);
-	LIMIT(b, 0, term.row-1);
+	LIMIT(t, 0, term->row-1);
+	LIMIT(b, 0, term->row-1);
 	if (t > b) {
 		temp = t;
 		t = b;
 		b = temp;
 	}
-	term.top = t;
-	term.bot = b;
+	term->top = t;
+	term->bot = b;
 }
 
 void
-tsetmode(int priv, int set, const int *args, int narg)
+tsetmode(Term *term, int priv, int set, const int *args, int narg)
 {
 	int alt; const int *lim;
 
@@ -1263,11 +2069,11 @@ tsetmode(int priv, int set, const int *args, int narg)
 				xsetmode(set, MODE_REVERSE);
 				break;
 			case 6: /* DECOM -- Origin */
-				MODBIT(term.c.state, set, CURSOR_ORIGIN);
-				tmoveato(0, 0);
+				MODBIT(term->c.state, set, CURSOR_ORIGIN);
+				tmoveato(term, 0, 0);
 				break;
 			case 7: /* DECAWM -- Auto wrap */
-				MODBIT(term.mode, set, MODE_WRAP);
+				MODBIT(term->mode, set, MODE_WRAP);
 				break;
 			case 0:  /* Error (IGNORED) */
 			case 2:  /* DECANM -- ANSI/VT52 (IGNORED) */
@@ -1314,7 +2120,7 @@ tsetmode(int priv, int set, const int *args, int narg)
 			case 1049: /* swap screen & set/restore cursor as xterm */
 				if (!allowaltscreen)
 					break;
-				tcursor((set) ? CURSOR_SAVE : CURSOR_LOAD);
+				tcursor(term, (set) ? CURSOR_SAVE : CURSOR_LOAD);
 				/* FALLTHROUGH */
 			case 47: /* swap screen */
 			case 1047:
@@ -1322,14 +2128,14 @@ tsetmode(int priv, int set, const int *args, int narg)
 					break;
 				alt = IS_SET(MODE_ALTSCREEN);
 				if (alt)
-					tclearregion(0, 0, term.col-1, term.row-1);
+					tclearregion(term, 0, 0, term->col-1, term->row-1);
 				if (set ^ alt) /* set is always 1 or 0 */
-					tswapscreen();
+					tswapscreen(term);
 				if (*args != 1049)
 					break;
 				/* FALLTHROUGH */
 			case 1048:
-				tcursor((set) ? CURSOR_SAVE : CURSOR_LOAD);
+				tcursor(term, (set) ? CURSOR_SAVE : CURSOR_LOAD);
 				break;
 			case 2004: /* 2004: bracketed paste mode */
 				xsetmode(set, MODE_BRCKTPASTE);
@@ -1358,13 +2164,13 @@ tsetmode(int priv, int set, const int *args, int narg)
 				xsetmode(set, MODE_KBDLOCK);
 				break;
 			case 4:  /* IRM -- Insertion-replacement */
-				MODBIT(term.mode, set, MODE_INSERT);
+				MODBIT(term->mode, set, MODE_INSERT);
 				break;
 			case 12: /* SRM -- Send/Receive */
-				MODBIT(term.mode, !set, MODE_ECHO);
+				MODBIT(term->mode, !set, MODE_ECHO);
 				break;
 			case 20: /* LNM -- Linefeed/new line */
-				MODBIT(term.mode, set, MODE_CRLF);
+				MODBIT(term->mode, set, MODE_CRLF);
 				break;
 			default:
 				fprintf(stderr, "erresc: unknown set/reset mode %d\n", *args);
@@ -1375,85 +2181,85 @@ tsetmode(int priv, int set, const int *args, int narg)
 }
 
 void
-csihandle(void)
+csihandle(Term *term)
 {
 	char buf[40];
 	int len;
 
-	switch (csiescseq.mode[0]) {
+	switch (term->csiescseq.mode[0]) {
 	default:
 	unknown:
 		fprintf(stderr, "erresc: unknown csi ");
-		csidump();
+		csidump(term);
 		/* die(""); */
 		break;
 	case '@': /* ICH -- Insert <n> blank char */
-		DEFAULT(csiescseq.arg[0], 1);
-		tinsertblank(csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tinsertblank(term, term->csiescseq.arg[0]);
 		break;
 	case 'A': /* CUU -- Cursor <n> Up */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(term.c.x, term.c.y-csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, term->c.x, term->c.y-term->csiescseq.arg[0]);
 		break;
 	case 'B': /* CUD -- Cursor <n> Down */
 	case 'e': /* VPR --Cursor <n> Down */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(term.c.x, term.c.y+csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, term->c.x, term->c.y+term->csiescseq.arg[0]);
 		break;
 	case 'i': /* MC -- Media Copy */
-		switch (csiescseq.arg[0]) {
+		switch (term->csiescseq.arg[0]) {
 		case 0:
-			tdump();
+			tdump(term);
 			break;
 		case 1:
-			tdumpline(term.c.y);
+			tdumpline(term, term->c.y);
 			break;
 		case 2:
-			tdumpsel();
+			tdumpsel(term);
 			break;
 		case 4:
-			term.mode &= ~MODE_PRINT;
+			term->mode &= ~MODE_PRINT;
 			break;
 		case 5:
-			term.mode |= MODE_PRINT;
+			term->mode |= MODE_PRINT;
 			break;
 		}
 		break;
 	case 'c': /* DA -- Device Attributes */
-		if (csiescseq.arg[0] == 0)
-			ttywrite(vtiden, strlen(vtiden), 0);
+		if (term->csiescseq.arg[0] == 0)
+			ttywrite(term, vtiden, strlen(vtiden), 0);
 		break;
 	case 'b': /* REP -- if last char is printable print it <n> more times */
-		DEFAULT(csiescseq.arg[0], 1);
-		if (term.lastc) {
-			while (csiescseq.arg[0]-- > 0)
-				tputc(term.lastc);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		if (term->lastc) {
+			while (term->csiescseq.arg[0]-- > 0)
+				tputc(term, term->lastc);
 		}
 		break;
 	case 'C': /* CUF -- Cursor <n> Forward */
 	case 'a': /* HPR -- Cursor <n> Forward */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(term.c.x+csiescseq.arg[0], term.c.y);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, term->c.x+term->csiescseq.arg[0], term->c.y);
 		break;
 	case 'D': /* CUB -- Cursor <n> Backward */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(term.c.x-csiescseq.arg[0], term.c.y);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, term->c.x-term->csiescseq.arg[0], term->c.y);
 		break;
 	case 'E': /* CNL -- Cursor <n> Down and first col */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(0, term.c.y+csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, 0, term->c.y+term->csiescseq.arg[0]);
 		break;
 	case 'F': /* CPL -- Cursor <n> Up and first col */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(0, term.c.y-csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, 0, term->c.y-term->csiescseq.arg[0]);
 		break;
 	case 'g': /* TBC -- Tabulation clear */
-		switch (csiescseq.arg[0]) {
+		switch (term->csiescseq.arg[0]) {
 		case 0: /* clear current tab stop */
-			term.tabs[term.c.x] = 0;
+			term->tabs[term->c.x] = 0;
 			break;
 		case 3: /* clear all the tabs */
-			memset(term.tabs, 0, term.col * sizeof(*term.tabs));
+			memset(term->tabs, 0, term->col * sizeof(*term->tabs));
 			break;
 		default:
 			goto unknown;
@@ -1461,120 +2267,120 @@ csihandle(void)
 		break;
 	case 'G': /* CHA -- Move to <col> */
 	case '`': /* HPA */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(csiescseq.arg[0]-1, term.c.y);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveto(term, term->csiescseq.arg[0]-1, term->c.y);
 		break;
 	case 'H': /* CUP -- Move to <row> <col> */
 	case 'f': /* HVP */
-		DEFAULT(csiescseq.arg[0], 1);
-		DEFAULT(csiescseq.arg[1], 1);
-		tmoveato(csiescseq.arg[1]-1, csiescseq.arg[0]-1);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		DEFAULT(term->csiescseq.arg[1], 1);
+		tmoveato(term, term->csiescseq.arg[1]-1, term->csiescseq.arg[0]-1);
 		break;
 	case 'I': /* CHT -- Cursor Forward Tabulation <n> tab stops */
-		DEFAULT(csiescseq.arg[0], 1);
-		tputtab(csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tputtab(term, term->csiescseq.arg[0]);
 		break;
 	case 'J': /* ED -- Clear screen */
-		switch (csiescseq.arg[0]) {
+		switch (term->csiescseq.arg[0]) {
 		case 0: /* below */
-			tclearregion(term.c.x, term.c.y, term.col-1, term.c.y);
-			if (term.c.y < term.row-1)
-				tclearregion(0, term.c.y+1, term.col-1, term.row-1);
+			tclearregion(term, term->c.x, term->c.y, term->col-1, term->c.y);
+			if (term->c.y < term->row-1)
+				tclearregion(term, 0, term->c.y+1, term->col-1, term->row-1);
 			break;
 		case 1: /* above */
-			if (term.c.y > 1)
-				tclearregion(0, 0, term.col-1, term.c.y-1);
-			tclearregion(0, term.c.y, term.c.x, term.c.y);
+			if (term->c.y > 1)
+				tclearregion(term, 0, 0, term->col-1, term->c.y-1);
+			tclearregion(term, 0, term->c.y, term->c.x, term->c.y);
 			break;
 		case 2: /* all */
-			tclearregion(0, 0, term.col-1, term.row-1);
+			tclearregion(term, 0, 0, term->col-1, term->row-1);
 			break;
 		default:
 			goto unknown;
 		}
 		break;
 	case 'K': /* EL -- Clear line */
-		switch (csiescseq.arg[0]) {
+		switch (term->csiescseq.arg[0]) {
 		case 0: /* right */
-			tclearregion(term.c.x, term.c.y, term.col-1, term.c.y);
+			tclearregion(term, term->c.x, term->c.y, term->col-1, term->c.y);
 			break;
 		case 1: /* left */
-			tclearregion(0, term.c.y, term.c.x, term.c.y);
+			tclearregion(term, 0, term->c.y, term->c.x, term->c.y);
 			break;
 		case 2: /* all */
-			tclearregion(0, term.c.y, term.col-1, term.c.y);
+			tclearregion(term, 0, term->c.y, term->col-1, term->c.y);
 			break;
 		}
 		break;
 	case 'S': /* SU -- Scroll <n> line up */
-		DEFAULT(csiescseq.arg[0], 1);
-		tscrollup(term.top, csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tscrollup(term, term->top, term->csiescseq.arg[0]);
 		break;
 	case 'T': /* SD -- Scroll <n> line down */
-		DEFAULT(csiescseq.arg[0], 1);
-		tscrolldown(term.top, csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tscrolldown(term, term->top, term->csiescseq.arg[0]);
 		break;
 	case 'L': /* IL -- Insert <n> blank lines */
-		DEFAULT(csiescseq.arg[0], 1);
-		tinsertblankline(csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tinsertblankline(term, term->csiescseq.arg[0]);
 		break;
 	case 'l': /* RM -- Reset Mode */
-		tsetmode(csiescseq.priv, 0, csiescseq.arg, csiescseq.narg);
+		tsetmode(term, term->csiescseq.priv, 0, term->csiescseq.arg, term->csiescseq.narg);
 		break;
 	case 'M': /* DL -- Delete <n> lines */
-		DEFAULT(csiescseq.arg[0], 1);
-		tdeleteline(csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tdeleteline(term, term->csiescseq.arg[0]);
 		break;
 	case 'X': /* ECH -- Erase <n> char */
-		DEFAULT(csiescseq.arg[0], 1);
-		tclearregion(term.c.x, term.c.y,
-				term.c.x + csiescseq.arg[0] - 1, term.c.y);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tclearregion(term, term->c.x, term->c.y,
+				term->c.x + term->csiescseq.arg[0] - 1, term->c.y);
 		break;
 	case 'P': /* DCH -- Delete <n> char */
-		DEFAULT(csiescseq.arg[0], 1);
-		tdeletechar(csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tdeletechar(term, term->csiescseq.arg[0]);
 		break;
 	case 'Z': /* CBT -- Cursor Backward Tabulation <n> tab stops */
-		DEFAULT(csiescseq.arg[0], 1);
-		tputtab(-csiescseq.arg[0]);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tputtab(term, -term->csiescseq.arg[0]);
 		break;
 	case 'd': /* VPA -- Move to <row> */
-		DEFAULT(csiescseq.arg[0], 1);
-		tmoveato(term.c.x, csiescseq.arg[0]-1);
+		DEFAULT(term->csiescseq.arg[0], 1);
+		tmoveato(term, term->c.x, term->csiescseq.arg[0]-1);
 		break;
 	case 'h': /* SM -- Set terminal mode */
-		tsetmode(csiescseq.priv, 1, csiescseq.arg, csiescseq.narg);
+		tsetmode(term, term->csiescseq.priv, 1, term->csiescseq.arg, term->csiescseq.narg);
 		break;
 	case 'm': /* SGR -- Terminal attribute (color) */
-		tsetattr(csiescseq.arg, csiescseq.narg);
+		tsetattr(term, term->csiescseq.arg, term->csiescseq.narg);
 		break;
 	case 'n': /* DSR – Device Status Report (cursor position) */
-		if (csiescseq.arg[0] == 6) {
+		if (term->csiescseq.arg[0] == 6) {
 			len = snprintf(buf, sizeof(buf), "\033[%i;%iR",
-					term.c.y+1, term.c.x+1);
-			ttywrite(buf, len, 0);
+					term->c.y+1, term->c.x+1);
+			ttywrite(term, buf, len, 0);
 		}
 		break;
 	case 'r': /* DECSTBM -- Set Scrolling Region */
-		if (csiescseq.priv) {
+		if (term->csiescseq.priv) {
 			goto unknown;
 		} else {
-			DEFAULT(csiescseq.arg[0], 1);
-			DEFAULT(csiescseq.arg[1], term.row);
-			tsetscroll(csiescseq.arg[0]-1, csiescseq.arg[1]-1);
-			tmoveato(0, 0);
+			DEFAULT(term->csiescseq.arg[0], 1);
+			DEFAULT(term->csiescseq.arg[1], term->row);
+			tsetscroll(term, term->csiescseq.arg[0]-1, term->csiescseq.arg[1]-1);
+			tmoveato(term, 0, 0);
 		}
 		break;
 	case 's': /* DECSC -- Save cursor position (ANSI.SYS) */
-		tcursor(CURSOR_SAVE);
+		tcursor(term, CURSOR_SAVE);
 		break;
 	case 'u': /* DECRC -- Restore cursor position (ANSI.SYS) */
-		tcursor(CURSOR_LOAD);
+		tcursor(term, CURSOR_LOAD);
 		break;
 	case ' ':
-		switch (csiescseq.mode[1]) {
+		switch (term->csiescseq.mode[1]) {
 		case 'q': /* DECSCUSR -- Set Cursor Style */
-			if (xsetcursor(csiescseq.arg[0]))
+			if (xsetcursor(term->csiescseq.arg[0]))
 				goto unknown;
 			break;
 		default:
@@ -1585,14 +2391,14 @@ csihandle(void)
 }
 
 void
-csidump(void)
+csidump(Term *term)
 {
 	size_t i;
 	uint c;
 
 	fprintf(stderr, "ESC[");
-	for (i = 0; i < csiescseq.len; i++) {
-		c = csiescseq.buf[i] & 0xff;
+	for (i = 0; i < term->csiescseq.len; i++) {
+		c = term->csiescseq.buf[i] & 0xff;
 		if (isprint(c))
 			putc(c, stderr);
 		else if (c == '\n')
@@ -1608,41 +2414,41 @@ csidump(void)
 }
 
 void
-csireset(void)
+csireset(Term *term)
 {
-	memset(&csiescseq, 0, sizeof(csiescseq));
+	memset(&term->csiescseq, 0, sizeof(term->csiescseq));
 }
 
 void
-strhandle(void)
+strhandle(Term *term)
 {
 	char *p = NULL, *dec;
 	int j, narg, par;
 
-	term.esc &= ~(ESC_STR_END|ESC_STR);
-	strparse();
-	par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
+	term->esc &= ~(ESC_STR_END|ESC_STR);
+	strparse(term);
+	par = (narg = term->strescseq.narg) ? atoi(term->strescseq.args[0]) : 0;
 
-	switch (strescseq.type) {
+	switch (term->strescseq.type) {
 	case ']': /* OSC -- Operating System Command */
 		switch (par) {
 		case 0:
 			if (narg > 1) {
-				xsettitle(strescseq.args[1]);
-				xseticontitle(strescseq.args[1]);
+				xsettitle(term->strescseq.args[1]);
+				xseticontitle(term->strescseq.args[1]);
 			}
 			return;
 		case 1:
 			if (narg > 1)
-				xseticontitle(strescseq.args[1]);
+				xseticontitle(term->strescseq.args[1]);
 			return;
 		case 2:
 			if (narg > 1)
-				xsettitle(strescseq.args[1]);
+				xsettitle(term->strescseq.args[1]);
 			return;
 		case 52:
 			if (narg > 2 && allowwindowops) {
-				dec = base64dec(strescseq.args[2]);
+				dec = base64dec(term->strescseq.args[2]);
 				if (dec) {
 					xsetsel(dec);
 					xclipcopy();
@@ -1654,24 +2460,22 @@ strhandle(void)
 		case 4: /* color set */
 			if (narg < 3)
 				break;
-			p = strescseq.args[2];
+			p = term->strescseq.args[2];
 			/* FALLTHROUGH */
 		case 104: /* color reset, here p = NULL */
-			j = (narg > 1) ? atoi(strescseq.args[1]) : -1;
+			j = (narg > 1) ? atoi(term->strescseq.args[1]) : -1;
 			if (xsetcolorname(j, p)) {
 				if (par == 104 && narg <= 1)
 					return; /* color reset without parameter */
 				fprintf(stderr, "erresc: invalid color j=%d, p=%s\n",
 				        j, p ? p : "(null)");
-			} else {
-				/* TODO if defaultbg color is changed, borders are dirty */
-				redraw();
 			}
+			/* the frontend marks what is to be drawn again */
 			return;
 		}
 		break;
 	case 'k': /* old title set compatibility */
-		xsettitle(strescseq.args[0]);
+		xsettitle(term->strescseq.args[0]);
 		return;
 	case 'P': /* DCS -- Device Control String */
 	case '_': /* APC -- Application Program Command */
@@ -1680,23 +2484,23 @@ strhandle(void)
 	}
 
 	fprintf(stderr, "erresc: unknown str ");
-	strdump();
+	strdump(term);
 }
 
 void
-strparse(void)
+strparse(Term *term)
 {
 	int c;
-	char *p = strescseq.buf;
+	char *p = term->strescseq.buf;
 
-	strescseq.narg = 0;
-	strescseq.buf[strescseq.len] = '\0';
+	term->strescseq.narg = 0;
+	term->strescseq.buf[term->strescseq.len] = '\0';
 
 	if (*p == '\0')
 		return;
 
-	while (strescseq.narg < STR_ARG_SIZ) {
-		strescseq.args[strescseq.narg++] = p;
+	while (term->strescseq.narg < STR_ARG_SIZ) {
+		term->strescseq.args[term->strescseq.narg++] = p;
 		while ((c = *p) != ';' && c != '\0')
 			++p;
 		if (c == '\0')
@@ -1706,14 +2510,14 @@ strparse(void)
 }
 
 void
-strdump(void)
+strdump(Term *term)
 {
 	size_t i;
 	uint c;
 
-	fprintf(stderr, "ESC%c", strescseq.type);
-	for (i = 0; i < strescseq.len; i++) {
-		c = strescseq.buf[i] & 0xff;
+	fprintf(stderr, "ESC%c", term->strescseq.type);
+	for (i = 0; i < term->strescseq.len; i++) {
+		c = term->strescseq.buf[i] & 0xff;
 		if (c == '\0') {
 			putc('\n', stderr);
 			return;
@@ -1733,23 +2537,23 @@ strdump(void)
 }
 
 void
-strreset(void)
+strreset(Term *term)
 {
-	strescseq = (STREscape){
-		.buf = xrealloc(strescseq.buf, STR_BUF_SIZ),
+	term->strescseq = (STREscape){
+		.buf = xrealloc(term->strescseq.buf, STR_BUF_SIZ),
 		.siz = STR_BUF_SIZ,
 	};
 }
 
 void
-tsendbreak(void)
+tsendbreak(Term *term)
 {
-	if (tcsendbreak(cmdfd, 0))
+	if (tcsendbreak(term->cmdfd, 0))
 		perror("Error sending break");
 }
 
 void
-tprinter(char *s, size_t len)
+tprinter(const char *s, size_t len)
 {
 	if (iofd != -1 && xwrite(iofd, s, len) < 0) {
 		perror("Error writing to output file");
@@ -1759,30 +2563,30 @@ tprinter(char *s, size_t len)
 }
 
 void
-ttogprinter(void)
+ttogprinter(Term *term)
 {
-	term.mode ^= MODE_PRINT;
+	term->mode ^= MODE_PRINT;
 }
 
 void
-tdumpsel(void)
+tdumpsel(Term *term)
 {
 	char *ptr;
 
-	if ((ptr = getsel())) {
+	if ((ptr = getsel(term))) {
 		tprinter(ptr, strlen(ptr));
 		free(ptr);
 	}
 }
 
 void
-tdumpline(int n)
+tdumpline(Term *term, int n)
 {
 	char buf[UTF_SIZ];
 	const Glyph *bp, *end;
 
-	bp = &term.line[n][0];
-	end = &bp[MIN(tlinelen(n), term.col) - 1];
+	bp = &term->line[n][0];
+	end = &bp[MIN(tlinelen(term, n), term->col) - 1];
 	if (bp != end || bp->u != ' ') {
 		for ( ; bp <= end; ++bp)
 			tprinter(buf, utf8enc(bp->u, buf));
@@ -1791,42 +2595,42 @@ tdumpline(int n)
 }
 
 void
-tdump(void)
+tdump(Term *term)
 {
 	int i;
 
-	for (i = 0; i < term.row; ++i)
-		tdumpline(i);
+	for (i = 0; i < term->row; ++i)
+		tdumpline(term, i);
 }
 
 void
-tputtab(int n)
+tputtab(Term *term, int n)
 {
-	uint x = term.c.x;
+	uint x = term->c.x;
 
 	if (n > 0) {
-		while (x < term.col && n--)
-			for (++x; x < term.col && !term.tabs[x]; ++x)
+		while (x < term->col && n--)
+			for (++x; x < term->col && !term->tabs[x]; ++x)
 				/* nothing */ ;
 	} else if (n < 0) {
 		while (x > 0 && n++)
-			for (--x; x > 0 && !term.tabs[x]; --x)
+			for (--x; x > 0 && !term->tabs[x]; --x)
 				/* nothing */ ;
 	}
-	term.c.x = LIMIT(x, 0, term.col-1);
+	term->c.x = LIMIT(x, 0, term->col-1);
 }
 
 void
-tdefutf8(char ascii)
+tdefutf8(Term *term, char ascii)
 {
 	if (ascii == 'G')
-		term.mode |= MODE_UTF8;
+		term->mode |= MODE_UTF8;
 	else if (ascii == '@')
-		term.mode &= ~MODE_UTF8;
+		term->mode &= ~MODE_UTF8;
 }
 
 void
-tdeftran(char ascii)
+tdeftran(Term *term, char ascii)
 {
 	static char cs[] = "0B";
 	static int vcs[] = {CS_GRAPHIC0, CS_USA};
@@ -1835,24 +2639,24 @@ tdeftran(char ascii)
 	if ((p = strchr(cs, ascii)) == NULL)
 		fprintf(stderr, "esc unhandled charset: ESC ( %c\n", ascii);
 	else
-		term.trantbl[term.icharset] = vcs[p - cs];
+		term->trantbl[term->icharset] = vcs[p - cs];
 }
 
 void
-tdectest(char c)
+tdectest(Term *term, char c)
 {
 	int x, y;
 
 	if (c == '8') { /* DEC screen alignment test. */
-		for (x = 0; x < term.col; ++x) {
-			for (y = 0; y < term.row; ++y)
-				tsetchar('E', &term.c.attr, x, y);
+		for (x = 0; x < term->col; ++x) {
+			for (y = 0; y < term->row; ++y)
+				tsetchar(term, 'E', &term->c.attr, x, y);
 		}
 	}
 }
 
 void
-tstrsequence(uchar c)
+tstrsequence(Term *term, uchar c)
 {
 	switch (c) {
 	case 0x90:   /* DCS -- Device Control String */
@@ -1868,52 +2672,52 @@ tstrsequence(uchar c)
 		c = ']';
 		break;
 	}
-	strreset();
-	strescseq.type = c;
-	term.esc |= ESC_STR;
+	strreset(term);
+	term->strescseq.type = c;
+	term->esc |= ESC_STR;
 }
 
 void
-tcontrolcode(uchar ascii)
+tcontrolcode(Term *term, uchar ascii)
 {
 	switch (ascii) {
 	case '\t':   /* HT */
-		tputtab(1);
+		tputtab(term, 1);
 		return;
 	case '\b':   /* BS */
-		tmoveto(term.c.x-1, term.c.y);
+		tmoveto(term, term->c.x-1, term->c.y);
 		return;
 	case '\r':   /* CR */
-		tmoveto(0, term.c.y);
+		tmoveto(term, 0, term->c.y);
 		return;
 	case '\f':   /* LF */
 	case '\v':   /* VT */
 	case '\n':   /* LF */
 		/* go to first col if the mode is set */
-		tnewline(IS_SET(MODE_CRLF));
+		tnewline(term, IS_SET(MODE_CRLF));
 		return;
 	case '\a':   /* BEL */
-		if (term.esc & ESC_STR_END) {
+		if (term->esc & ESC_STR_END) {
 			/* backwards compatibility to xterm */
-			strhandle();
+			strhandle(term);
 		} else {
 			xbell();
 		}
 		break;
 	case '\033': /* ESC */
-		csireset();
-		term.esc &= ~(ESC_CSI|ESC_ALTCHARSET|ESC_TEST);
-		term.esc |= ESC_START;
+		csireset(term);
+		term->esc &= ~(ESC_CSI|ESC_ALTCHARSET|ESC_TEST);
+		term->esc |= ESC_START;
 		return;
 	case '\016': /* SO (LS1 -- Locking shift 1) */
 	case '\017': /* SI (LS0 -- Locking shift 0) */
-		term.charset = 1 - (ascii - '\016');
+		term->charset = 1 - (ascii - '\016');
 		return;
 	case '\032': /* SUB */
-		tsetchar('?', &term.c.attr, term.c.x, term.c.y);
+		tsetchar(term, '?', &term->c.attr, term->c.x, term->c.y);
 		/* FALLTHROUGH */
 	case '\030': /* CAN */
-		csireset();
+		csireset(term);
 		break;
 	case '\005': /* ENQ (IGNORED) */
 	case '\000': /* NUL (IGNORED) */
@@ -1928,13 +2732,13 @@ tcontrolcode(uchar ascii)
 	case 0x84:   /* TODO: IND */
 		break;
 	case 0x85:   /* NEL -- Next line */
-		tnewline(1); /* always go to first col */
+		tnewline(term, 1); /* always go to first col */
 		break;
 	case 0x86:   /* TODO: SSA */
 	case 0x87:   /* TODO: ESA */
 		break;
 	case 0x88:   /* HTS -- Horizontal tab stop */
-		term.tabs[term.c.x] = 1;
+		term->tabs[term->c.x] = 1;
 		break;
 	case 0x89:   /* TODO: HTJ */
 	case 0x8a:   /* TODO: VTS */
@@ -1954,7 +2758,7 @@ tcontrolcode(uchar ascii)
 	case 0x99:   /* TODO: SGCI */
 		break;
 	case 0x9a:   /* DECID -- Identify Terminal */
-		ttywrite(vtiden, strlen(vtiden), 0);
+		ttywrite(term, vtiden, strlen(vtiden), 0);
 		break;
 	case 0x9b:   /* TODO: CSI */
 	case 0x9c:   /* TODO: ST */
@@ -1963,69 +2767,69 @@ tcontrolcode(uchar ascii)
 	case 0x9d:   /* OSC -- Operating System Command */
 	case 0x9e:   /* PM -- Privacy Message */
 	case 0x9f:   /* APC -- Application Program Command */
-		tstrsequence(ascii);
+		tstrsequence(term, ascii);
 		return;
 	}
 	/* only CAN, SUB, \a and C1 chars interrupt a sequence */
-	term.esc &= ~(ESC_STR_END|ESC_STR);
+	term->esc &= ~(ESC_STR_END|ESC_STR);
 }
 
 /* returns 1 when the sequence is finished and it hasn't to read
  * more characters for this sequence, otherwise 0 */
 int
-eschandle(uchar ascii)
+eschandle(Term *term, uchar ascii)
 {
 	switch (ascii) {
 	case '[':
-		term.esc |= ESC_CSI;
+		term->esc |= ESC_CSI;
 		return 0;
 	case '#':
-		term.esc |= ESC_TEST;
+		term->esc |= ESC_TEST;
 		return 0;
 	case '%':
-		term.esc |= ESC_UTF8;
+		term->esc |= ESC_UTF8;
 		return 0;
 	case 'P': /* DCS -- Device Control String */
 	case '_': /* APC -- Application Program Command */
 	case '^': /* PM -- Privacy Message */
 	case ']': /* OSC -- Operating System Command */
 	case 'k': /* old title set compatibility */
-		tstrsequence(ascii);
+		tstrsequence(term, ascii);
 		return 0;
 	case 'n': /* LS2 -- Locking shift 2 */
 	case 'o': /* LS3 -- Locking shift 3 */
-		term.charset = 2 + (ascii - 'n');
+		term->charset = 2 + (ascii - 'n');
 		break;
 	case '(': /* GZD4 -- set primary charset G0 */
 	case ')': /* G1D4 -- set secondary charset G1 */
 	case '*': /* G2D4 -- set tertiary charset G2 */
 	case '+': /* G3D4 -- set quaternary charset G3 */
-		term.icharset = ascii - '(';
-		term.esc |= ESC_ALTCHARSET;
+		term->icharset = ascii - '(';
+		term->esc |= ESC_ALTCHARSET;
 		return 0;
 	case 'D': /* IND -- Linefeed */
-		if (term.c.y == term.bot)
-			tscrollup(term.top, 1);
+		if (term->c.y == term->bot)
+			tscrollup(term, term->top, 1);
 		else
-			tmoveto(term.c.x, term.c.y+1);
+			tmoveto(term, term->c.x, term->c.y+1);
 		break;
 	case 'E': /* NEL -- Next line */
-		tnewline(1); /* always go to first col */
+		tnewline(term, 1); /* always go to first col */
 		break;
 	case 'H': /* HTS -- Horizontal tab stop */
-		term.tabs[term.c.x] = 1;
+		term->tabs[term->c.x] = 1;
 		break;
 	case 'M': /* RI -- Reverse index */
-		if (term.c.y == term.top)
-			tscrolldown(term.top, 1);
+		if (term->c.y == term->top)
+			tscrolldown(term, term->top, 1);
 		else
-			tmoveto(term.c.x, term.c.y-1);
+			tmoveto(term, term->c.x, term->c.y-1);
 		break;
 	case 'Z': /* DECID -- Identify Terminal */
-		ttywrite(vtiden, strlen(vtiden), 0);
+		ttywrite(term, vtiden, strlen(vtiden), 0);
 		break;
 	case 'c': /* RIS -- Reset to initial state */
-		treset();
+		treset(term);
 		xsettitle(NULL);
 		xloadcolors();
 		break;
@@ -2036,14 +2840,14 @@ eschandle(uchar ascii)
 		xsetmode(0, MODE_APPKEYPAD);
 		break;
 	case '7': /* DECSC -- Save Cursor */
-		tcursor(CURSOR_SAVE);
+		tcursor(term, CURSOR_SAVE);
 		break;
 	case '8': /* DECRC -- Restore Cursor */
-		tcursor(CURSOR_LOAD);
+		tcursor(term, CURSOR_LOAD);
 		break;
 	case '\\': /* ST -- String Terminator */
-		if (term.esc & ESC_STR_END)
-			strhandle();
+		if (term->esc & ESC_STR_END)
+			strhandle(term);
 		break;
 	default:
 		fprintf(stderr, "erresc: unknown sequence ESC 0x%02X '%c'\n",
@@ -2054,12 +2858,14 @@ eschandle(uchar ascii)
 }
 
 void
-tputc(Rune u)
+tputc(Term *term, Rune u)
 {
 	char c[UTF_SIZ];
 	int control;
 	int width, len;
 	Glyph *gp;
+	Lineinfo *info;
+	Attr attr;
 
 	control = ISCONTROL(u);
 	if (u < 127 || !IS_SET(MODE_UTF8)) {
@@ -2071,22 +2877,19 @@ tputc(Rune u)
 			width = 1;
 	}
 
-	if (IS_SET(MODE_PRINT))
-		tprinter(c, len);
-
 	/* STR sequence must be checked before anything else
 	 * because it uses all following characters until it
 	 * receives a ESC, a SUB, a ST or any other C1 control
 	 * character. */
-	if (term.esc & ESC_STR) {
+	if (term->esc & ESC_STR) {
 		if (u == '\a' || u == 030 || u == 032 || u == 033 ||
 		   ISCONTROLC1(u)) {
-			term.esc &= ~(ESC_START|ESC_STR);
-			term.esc |= ESC_STR_END;
+			term->esc &= ~(ESC_START|ESC_STR);
+			term->esc |= ESC_STR_END;
 			goto check_control_code;
 		}
 
-		if (strescseq.len+len >= strescseq.siz) {
+		if (term->strescseq.len+len >= term->strescseq.siz) {
 			/* Here is a bug in terminals. If the user never sends
 			 * some code to stop the str or esc command, then st
 			 * will stop responding. But this is better than
@@ -2094,16 +2897,16 @@ tputc(Rune u)
 			 * then users will report back.
 			 *
 			 * In the case users ever get fixed, here is the code: */
-			/* term.esc = 0;
-			 * strhandle(); */
-			if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
+			/* term->esc = 0;
+			 * strhandle(term); */
+			if (term->strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
 				return;
-			strescseq.siz *= 2;
-			strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
+			term->strescseq.siz *= 2;
+			term->strescseq.buf = xrealloc(term->strescseq.buf, term->strescseq.siz);
 		}
 
-		memmove(&strescseq.buf[strescseq.len], c, len);
-		strescseq.len += len;
+		memmove(&term->strescseq.buf[term->strescseq.len], c, len);
+		term->strescseq.len += len;
 		return;
 	}
 
@@ -2112,79 +2915,94 @@ check_control_code:
 	 * because they can be embedded inside a control sequence, and
 	 * they must not cause conflicts with sequences. */
 	if (control) {
-		tcontrolcode(u);
+		tcontrolcode(term, u);
 		/* control codes are not shown ever */
-		if (!term.esc)
-			term.lastc = 0;
+		if (!term->esc)
+			term->lastc = 0;
 		return;
-	} else if (term.esc & ESC_START) {
-		if (term.esc & ESC_CSI) {
-			csiescseq.buf[csiescseq.len++] = u;
+	} else if (term->esc & ESC_START) {
+		if (term->esc & ESC_CSI) {
+			term->csiescseq.buf[term->csiescseq.len++] = u;
 			if (BETWEEN(u, 0x40, 0x7E) ||
-					csiescseq.len >= sizeof(csiescseq.buf)-1) {
-				term.esc = 0;
-				csiparse();
-				csihandle();
+					term->csiescseq.len >= sizeof(term->csiescseq.buf)-1) {
+				term->esc = 0;
+				csiparse(term);
+				csihandle(term);
 			}
 			return;
-		} else if (term.esc & ESC_UTF8) {
-			tdefutf8(u);
-		} else if (term.esc & ESC_ALTCHARSET) {
-			tdeftran(u);
-		} else if (term.esc & ESC_TEST) {
-			tdectest(u);
+		} else if (term->esc & ESC_UTF8) {
+			tdefutf8(term, u);
+		} else if (term->esc & ESC_ALTCHARSET) {
+			tdeftran(term, u);
+		} else if (term->esc & ESC_TEST) {
+			tdectest(term, u);
 		} else {
-			if (!eschandle(u))
+			if (!eschandle(term, u))
 				return;
 			/* sequence already finished */
 		}
-		term.esc = 0;
+		term->esc = 0;
 		/* All characters which form part of a sequence are not
 		 * printed */
 		return;
 	}
-	if (selected(term.c.x, term.c.y))
-		selclear();
-
-	gp = &term.line[term.c.y][term.c.x];
-	if (IS_SET(MODE_WRAP) && (term.c.state & CURSOR_WRAPNEXT)) {
-		gp->mode |= ATTR_WRAP;
-		tnewline(1);
-		gp = &term.line[term.c.y][term.c.x];
+	if (selected(term, term->c.x, term->c.y))
+		selclear(term);
+
+	gp = &term->line[term->c.y][term->c.x];
+	if (IS_SET(MODE_WRAP) && (term->c.state & CURSOR_WRAPNEXT)) {
+		glyphmode(term, gp, ATTR_WRAP, 0);
+		tnewline(term, 1);
+		gp = &term->line[term->c.y][term->c.x];
 	}
 
-	if (IS_SET(MODE_INSERT) && term.c.x+width < term.col)
-		memmove(gp+width, gp, (term.col - term.c.x - width) * sizeof(Glyph));
-
-	if (term.c.x+width > term.col) {
-		tnewline(1);
-		gp = &term.line[term.c.y][term.c.x];
+	if (IS_SET(MODE_INSERT) && term->c.x+width < term->col) {
+		memmove(gp+width, gp, (term->col - term->c.x - width) * sizeof(Glyph));
+		info = &term->info[term->c.y];
+		info->len = MIN(info->len + width, term->col);
 	}
 
-	tsetchar(u, &term.c.attr, term.c.x, term.c.y);
-	term.lastc = u;
+	if (term->c.x+width > term->col) {
+		tnewline(term, 1);
+		gp = &term->line[term->c.y][term->c.x];
+	}
 
 	if (width == 2) {
-		gp->mode |= ATTR_WIDE;
-		if (term.c.x+1 < term.col) {
-			gp[1].u = '\0';
-			gp[1].mode = ATTR_WDUMMY;
+		attr = term->c.attr;
+		attr.mode |= ATTR_WIDE;
+		tsetchar(term, u, &attr, term->c.x, term->c.y);
+		if (term->c.x+1 < term->col) {
+			attr.mode = ATTR_WDUMMY;
+			gp[1] = (Glyph){ '\0', tattr(term, &attr) };
+			tusecell(term, term->c.x+1, term->c.y, &attr);
 		}
+	} else {
+		tsetchar(term, u, &term->c.attr, term->c.x, term->c.y);
 	}
-	if (term.c.x+width < term.col)
-		tmoveto(term.c.x+width, term.c.y);
+	term->lastc = u;
+	if (term->c.x+width < term->col)
+		tmoveto(term, term->c.x+width, term->c.y);
 	else
-		term.c.state |= CURSOR_WRAPNEXT;
+		term->c.state |= CURSOR_WRAPNEXT;
 }
 
 int
-twrite(const char *buf, int buflen, int show_ctrl)
+twrite(Term *term, const char *buf, int buflen, int show_ctrl)
 {
 	int charsize;
 	Rune u;
-	int n;
-
-	for (n = 0; n < buflen; n += charsize) {
+	int n, p;
+
+	/* In print mode the input is passed to the printer untouched. Bytes
+	 * are gathered from p on and written out in one go whenever the
+	 * mode is left or the buffer is exhausted. */
+	for (n = 0, p = -1; n < buflen; n += charsize) {
+		if (IS_SET(MODE_PRINT) && p < 0) {
+			p = n;
+		} else if (!IS_SET(MODE_PRINT) && p >= 0) {
+			tprinter(buf + p, n - p);
+			p = -1;
+		}
 		if (IS_SET(MODE_UTF8)) {
 			/* process a complete utf8 char */
 			charsize = utf8dec(buf + n, &u, buflen - n);
@@ -2197,26 +3015,31 @@ twrite(const char *buf, int buflen, int show_ctrl)
 		if (show_ctrl && ISCONTROL(u)) {
 			if (u & 0x80) {
 				u &= 0x7f;
-				tputc('^');
-				tputc('[');
+				tputc(term, '^');
+				tputc(term, '[');
 			} else if (u != '\n' && u != '\r' && u != '\t') {
 				u ^= 0x40;
-				tputc('^');
+				tputc(term, '^');
 			}
 		}
-		tputc(u);
+		tputc(term, u);
 	}
+	if (p >= 0)
+		tprinter(buf + p, n - p);
 	return n;
 }
 
 void
-tresize(int col, int row)
+tresize(Term *term, int col, int row)
 {
-	int i;
-	int minrow = MIN(row, term.row);
-	int mincol = MIN(col, term.col);
+	int i, n;
+	int minrow = MIN(row, term->row);
+	int mincol = MIN(col, term->col);
+	int reflow = term->row > 0 && col != term->col;
+	int alt = IS_SET(MODE_ALTSCREEN);
 	int *bp;
-	TCursor c;
+	TCursor c, *rc[2];
+	Reflow rf;
 
 	if (col < 1 || row < 1) {
 		fprintf(stderr, "tresize: error resizing to %dx%d\n", col, row);
@@ -2226,109 +3049,444 @@ tresize(int col, int row)
 	/* slide screen to keep cursor where we expect it -
 	 * tscrollup would work here, but we can optimize to
 	 * memmove because we're freeing the earlier lines */
-	for (i = 0; i <= term.c.y - row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
+	n = MAX(term->c.y - row + 1, 0);
+	if (reflow) {
+		/* the main screen is rewrapped, even while a program has the
+		 * alternate one: it is what is left when the program ends */
+		if (alt)
+			tswapscreen(term);
+		rc[0] = alt ? &term->sc[0] : &term->c;
+		rc[1] = &term->sc[0];
+		for (i = 0; i < 2; i++) {
+			rf.x[i] = MIN(rc[i]->x, term->col - 1);
+			rf.y[i] = MIN(rc[i]->y, term->row - 1);
+		}
+		selclear(term);
+		treflow(term, col, row, &rf);
+	} else {
+		tresizelines(term, &term->line, &term->info, n, col, row);
 	}
-	/* ensure that both src and dst are not NULL */
-	if (i > 0) {
-		memmove(term.line, term.line + i, row * sizeof(Line));
-		memmove(term.alt, term.alt + i, row * sizeof(Line));
+	tresizelines(term, &term->alt, &term->altinfo, n, col, row);
+
+	term->dirty = xrealloc(term->dirty, row * sizeof(*term->dirty));
+	term->hit = xrealloc(term->hit, row * sizeof(*term->hit));
+	memset(term->hit, 0, row * sizeof(*term->hit));
+	term->sig = xrealloc(term->sig, row * sizeof(*term->sig));
+	memset(term->sig, 0, row * sizeof(*term->sig));
+	term->hl = xrealloc(term->hl, col);
+	term->tabs = xrealloc(term->tabs, col * sizeof(*term->tabs));
+
+	if (col > term->col) {
+		bp = term->tabs + term->col;
+
+		memset(bp, 0, sizeof(*term->tabs) * (col - term->col));
+		while (--bp > term->tabs && !*bp)
+			/* nothing */ ;
+		for (bp += tabspaces; bp < term->tabs + col; bp += tabspaces)
+			*bp = 1;
+	}
+	/* update terminal size */
+	term->col = col;
+	term->row = row;
+	if (reflow) {
+		treflowwrap(term, &rf);
+		for (i = 1; i >= 0; i--) {
+			rc[i]->x = rf.x[i];
+			rc[i]->y = MAX(rf.y[i], 0);
+		}
+		if (alt)
+			tswapscreen(term);
+		tfulldirt(term);
 	}
-	for (i += row; i < term.row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
+	/* reset scrolling region */
+	tsetscroll(term, 0, row-1);
+	/* make use of the LIMIT in tmoveto */
+	tmoveto(term, term->c.x, term->c.y);
+	/* Clearing both screens (it makes dirty all lines), but for the
+	 * rewrapped one */
+	c = term->c;
+	for (i = 0; i < 2; i++) {
+		if (!reflow || i != alt) {
+			if (mincol < col && 0 < minrow)
+				tclearregion(term, mincol, 0, col - 1, minrow - 1);
+			if (0 < col && minrow < row)
+				tclearregion(term, 0, minrow, col - 1, row - 1);
+		}
+		tswapscreen(term);
+		tcursor(term, CURSOR_LOAD);
 	}
+	term->c = c;
+}
+
+/* Resize the lines of one screen, the first n of them going away */
+void
+tresizelines(Term *term, Line **lp, Lineinfo **ip, int n, int col, int row)
+{
+	Line *line = *lp;
+	Lineinfo *info = *ip;
+	int i;
+	int minrow = MIN(row, term->row);
+	int mincol = MIN(col, term->col);
+
+	for (i = 0; i < n; i++)
+		free(line[i]);
+	/* ensure that both src and dst are not NULL */
+	if (n > 0) {
+		memmove(line, line + n, row * sizeof(Line));
+		memmove(info, info + n, row * sizeof(Lineinfo));
+	}
+	for (i = n + row; i < term->row; i++)
+		free(line[i]);
 
 	/* resize to new height */
-	term.line = xrealloc(term.line, row * sizeof(Line));
-	term.alt  = xrealloc(term.alt,  row * sizeof(Line));
-	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
-	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
+	line = xrealloc(line, row * sizeof(Line));
+	info = xrealloc(info, row * sizeof(Lineinfo));
 
 	/* resize each row to new width, zero-pad if needed */
 	for (i = 0; i < minrow; i++) {
-		term.line[i] = xrealloc(term.line[i], col * sizeof(Glyph));
-		term.alt[i]  = xrealloc(term.alt[i],  col * sizeof(Glyph));
+		line[i] = xrealloc(line[i], col * sizeof(Glyph));
+		if (col > mincol) {
+			memset(line[i] + mincol, 0,
+			       (col - mincol) * sizeof(Glyph));
+		}
 	}
 
-	/* allocate any new rows */
+	/* allocate any new rows, blank until cleared by tresize() */
 	for (/* i = minrow */; i < row; i++) {
-		term.line[i] = xmalloc(col * sizeof(Glyph));
-		term.alt[i] = xmalloc(col * sizeof(Glyph));
+		line[i] = xmalloc(col * sizeof(Glyph));
+		memset(line[i], 0, col * sizeof(Glyph));
+		memset(&info[i], 0, sizeof(Lineinfo));
 	}
-	if (col > term.col) {
-		bp = term.tabs + term.col;
 
-		memset(bp, 0, sizeof(*term.tabs) * (col - term.col));
-		while (--bp > term.tabs && !*bp)
-			/* nothing */ ;
-		for (bp += tabspaces; bp < term.tabs + col; bp += tabspaces)
-			*bp = 1;
+	*lp = line;
+	*ip = info;
+}
+
+/* Rewrap the screen to the new width: the rows joined by ATTR_WRAP are cut
+ * again into rows of col glyphs. The first pass counts the rows, the second
+ * copies the glyphs into them. The cursors of rf stay on their glyphs. */
+void
+treflow(Term *term, int col, int row, Reflow *rf)
+{
+	Line *line = term->line, *dst = NULL;
+	Lineinfo *info = NULL;
+	const Glyph blank = { ' ', 0 }, *g;
+	uint32_t colors[8];
+	int pass, last, y, ly, i, j, k, len, off[2], r, r0, x, w, mode;
+	int oc = term->col, skip = 0, cx[2], cy[2];
+
+	memcpy(cx, rf->x, sizeof(cx));
+	memcpy(cy, rf->y, sizeof(cy));
+	rf->fix = NULL;
+	rf->nfix = rf->fixsiz = 0;
+	/* the blank lines below the cursors are dropped */
+	for (last = term->row - 1; last > MAX(cy[0], cy[1]) &&
+	     tlinelen(term, last) == 0; last--)
+		;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (y = r = 0; y <= last; y++, r++) {
+			for (ly = y; y < last &&
+			     (term->attrs[line[y][oc - 1].a].mode & ATTR_WRAP); y++)
+				;
+			len = (y - ly) * oc + tlinelen(term, y);
+			for (k = 0; k < 2; k++) {
+				off[k] = -1;
+				if (BETWEEN(cy[k], ly, y)) {
+					off[k] = (cy[k] - ly) * oc + cx[k];
+					len = MAX(len, off[k] + 1);
+				}
+			}
+
+			for (i = x = 0, r0 = r; i < len; i += w, x += w) {
+				g = &line[ly + i / oc][i % oc];
+				mode = term->attrs[g->a].mode;
+				w = (mode & ATTR_WIDE) && i % oc < oc - 1 ? 2 : 1;
+				/* the blank left by a wide glyph wrapping early */
+				if (i % oc == oc - 1 && i + 1 < len && g->u == ' ' &&
+				    (term->attrs[line[ly + i / oc + 1][0].a].mode &
+				     ATTR_WIDE)) {
+					for (k = 0; k < 2; k++) {
+						if (off[k] != i)
+							continue;
+						rf->x[k] = MIN(x, col - 1);
+						rf->y[k] = r - skip;
+					}
+					x--;
+					continue;
+				}
+				if (x > 0 && x + w > col) {
+					if (dst && BETWEEN(r - skip, 0, row - 1))
+						rf->wrap[r - skip] = 1;
+					r++;
+					x = 0;
+				}
+				for (k = 0; k < 2; k++) {
+					if (off[k] < i || off[k] >= i + w)
+						continue;
+					rf->x[k] = MIN(x + off[k] - i, col - 1);
+					rf->y[k] = r - skip;
+				}
+				if (!dst || !BETWEEN(r - skip, 0, row - 1))
+					continue;
+				for (j = 0; j < w && x + j < col; j++) {
+					dst[r - skip][x + j] =
+						line[ly + (i + j) / oc][(i + j) % oc];
+					if (!(term->attrs[dst[r - skip][x + j].a].mode
+					    & ATTR_WRAP))
+						continue;
+					if (rf->nfix == rf->fixsiz) {
+						rf->fixsiz = 2 * rf->fixsiz + 16;
+						rf->fix = xrealloc(rf->fix,
+						        rf->fixsiz * sizeof(int));
+					}
+					rf->fix[rf->nfix++] = (r - skip) * col + x + j;
+				}
+				info[r - skip].len = MIN(x + w, col);
+			}
+			if (!dst)
+				continue;
+
+			/* the colors of the rows go to all of theirs */
+			memset(colors, 0, sizeof(colors));
+			for (i = ly; i <= y; i++) {
+				for (j = 0; j < LEN(colors); j++)
+					colors[j] |= term->info[i].colors[j];
+			}
+			for (i = MAX(r0, skip); i <= r && i - skip < row; i++) {
+				for (j = 0; j < LEN(colors); j++)
+					info[i - skip].colors[j] |= colors[j];
+			}
+		}
+		if (dst)
+			break;
+
+		/* the new screen is allocated once; the rows which do not
+		 * fit go from the top, as long as the cursor stays */
+		skip = MIN(MAX(r - row, 0), rf->y[0]);
+		dst = xmalloc(row * sizeof(Line));
+		info = xmalloc(row * sizeof(Lineinfo));
+		memset(info, 0, row * sizeof(Lineinfo));
+		rf->wrap = xmalloc(row);
+		memset(rf->wrap, 0, row);
+		for (i = 0; i < row; i++) {
+			dst[i] = xmalloc(col * sizeof(Glyph));
+			for (j = 0; j < col; j++)
+				dst[i][j] = blank;
+		}
 	}
-	/* update terminal size */
-	term.col = col;
-	term.row = row;
-	/* reset scrolling region */
-	tsetscroll(0, row-1);
-	/* make use of the LIMIT in tmoveto */
-	tmoveto(term.c.x, term.c.y);
-	/* Clearing both screens (it makes dirty all lines) */
-	c = term.c;
-	for (i = 0; i < 2; i++) {
-		if (mincol < col && 0 < minrow)
-			tclearregion(mincol, 0, col - 1, minrow - 1);
-		if (0 < col && minrow < row)
-			tclearregion(0, minrow, col - 1, row - 1);
-		tswapscreen();
-		tcursor(CURSOR_LOAD);
+
+	for (i = 0; i < term->row; i++)
+		free(line[i]);
+	free(line);
+	free(term->info);
+	term->line = dst;
+	term->info = info;
+}
+
+/* The wraps of the rewrapped screen, once it is the size of the others:
+ * tattr() may walk both screens. */
+void
+treflowwrap(Term *term, Reflow *rf)
+{
+	int i;
+
+	for (i = 0; i < rf->nfix; i++) {
+		glyphmode(term, &term->line[rf->fix[i] / term->col]
+		                     [rf->fix[i] % term->col], 0, ATTR_WRAP);
+	}
+	for (i = 0; i < term->row; i++) {
+		if (rf->wrap[i])
+			glyphmode(term, &term->line[i][term->col - 1], ATTR_WRAP, 0);
 	}
-	term.c = c;
+	free(rf->fix);
+	free(rf->wrap);
 }
 
 void
-drawregion(int x1, int y1, int x2, int y2)
+drawregion(Term *term, int x1, int y1, int x2, int y2)
 {
 	int y;
 
 	for (y = y1; y < y2; y++) {
-		if (!term.dirty[y])
+		if (!term->dirty[y])
 			continue;
 
-		term.dirty[y] = 0;
-		xdrawline(term.line[y], x1, y, x2);
+		term->dirty[y] = 0;
+		term->sig[y].ok = 0;
+		term->hit[y] = term->querylen > 0 && tsearchline(term, y);
+		xdrawline(term->line[y], x1, y, x2);
 	}
 }
 
+/* Highlight the matches of q on the screen, none if n is 0. The matches of
+ * a query typed further are in the lines of the shorter one, only those are
+ * searched again; otherwise, the lines whose signature rules it out are
+ * left alone. */
+void
+tsearch(Term *term, const Rune *q, int n)
+{
+	Linesig m;
+	int y, narrow;
+
+	narrow = term->querylen > 0 && n >= term->querylen &&
+	         !memcmp(q, term->query, term->querylen * sizeof(Rune));
+	sigquery(&m, q, n);
+	for (y = 0; y < term->row; y++) {
+		if (term->hit[y] || (n > 0 && !narrow &&
+		    tmaymatch(term, y, &m)))
+			term->dirty[y] = 1;
+	}
+
+	free(term->query);
+	term->query = NULL;
+	if ((term->querylen = n) > 0) {
+		term->query = xmalloc(n * sizeof(Rune));
+		memcpy(term->query, q, n * sizeof(Rune));
+	}
+}
+
+void
+sigadd(Linesig *s, Rune u, Rune next)
+{
+	uint32_t h;
+
+	h = (u * 0x9E3779B1U) >> 23;
+	s->bits[h >> 6] |= 1ULL << (h & 63);
+	if (next) {
+		h = (u * 0x9E3779B1U ^ next * 0x85EBCA77U) >> 23;
+		s->bits[h >> 6] |= 1ULL << (h & 63);
+	}
+}
+
+void
+sigquery(Linesig *s, const Rune *q, int n)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	for (i = 0; i < n; i++)
+		sigadd(s, q[i], i + 1 < n ? q[i + 1] : 0);
+}
+
+/* Whether line y may contain the query of signature m */
+int
+tmaymatch(Term *term, int y, const Linesig *m)
+{
+	Linesig *s = &term->sig[y];
+	const Line line = term->line[y];
+	int x, i;
+
+	/* dirty lines are searched when drawn anyway */
+	if (!searchindex || term->dirty[y])
+		return 1;
+	if (!s->ok) {
+		memset(s, 0, sizeof(*s));
+		for (x = 0; x < term->col; x = i) {
+			for (i = x + 1; i < term->col &&
+			     (term->attrs[line[i].a].mode & ATTR_WDUMMY); i++)
+				;
+			sigadd(s, line[x].u, i < term->col ? line[i].u : 0);
+		}
+		s->ok = 1;
+	}
+	for (i = 0; i < LEN(s->bits); i++) {
+		if ((s->bits[i] & m->bits[i]) != m->bits[i])
+			return 0;
+	}
+	return 1;
+}
+
+/* Mark the matches of the query in line y, skipping the right halves of
+ * wide glyphs */
+int
+tsearchline(Term *term, int y)
+{
+	const Glyph *line = term->line[y];
+	const Rune *q = term->query;
+	int x, i, j, n = term->querylen, hit = 0;
+
+	memset(term->hl, 0, term->col);
+	for (x = 0; x <= term->col - n; x++) {
+		if (line[x].u != q[0])
+			continue;
+		for (i = 1, j = x + 1; i < n && j < term->col; j++) {
+			if (term->attrs[line[j].a].mode & ATTR_WDUMMY)
+				continue;
+			if (line[j].u != q[i])
+				break;
+			i++;
+		}
+		if (i < n)
+			continue;
+		memset(term->hl + x, 1, j - x);
+		hit = 1;
+		x = j - 1;
+	}
+	return hit;
+}
+
+/* Matches in the line being drawn, for xdrawline() */
+const char *
+tfound(Term *term)
+{
+	return term->querylen > 0 ? term->hl : NULL;
+}
+
+/* Select the last match on the screen */
+int
+tsearchsel(Term *term)
+{
+	Linesig m;
+	int x1, x2, y;
+
+	if (term->querylen == 0)
+		return 0;
+	sigquery(&m, term->query, term->querylen);
+	for (y = term->row - 1; y >= 0; y--) {
+		if (!tmaymatch(term, y, &m) || !tsearchline(term, y))
+			continue;
+		for (x2 = term->col; !term->hl[x2 - 1]; x2--)
+			;
+		for (x1 = x2 - 1; x1 > 0 && term->hl[x1 - 1]; x1--)
+			;
+		selstart(term, x1, y, 0);
+		selextend(term, x2 - 1, y, SEL_REGULAR, 0);
+		selextend(term, x2 - 1, y, SEL_REGULAR, 1);
+		return 1;
+	}
+	return 0;
+}
+
 void
-draw(void)
+draw(Term *term)
 {
-	int cx = term.c.x, ocx = term.ocx, ocy = term.ocy;
+	int cx = term->c.x, ocx = term->ocx, ocy = term->ocy;
 
 	if (!xstartdraw())
 		return;
 
 	/* adjust cursor position */
-	LIMIT(term.ocx, 0, term.col-1);
-	LIMIT(term.ocy, 0, term.row-1);
-	if (term.line[term.ocy][term.ocx].mode & ATTR_WDUMMY)
-		term.ocx--;
-	if (term.line[term.c.y][cx].mode & ATTR_WDUMMY)
+	LIMIT(term->ocx, 0, term->col-1);
+	LIMIT(term->ocy, 0, term->row-1);
+	if (term->attrs[term->line[term->ocy][term->ocx].a].mode & ATTR_WDUMMY)
+		term->ocx--;
+	if (term->attrs[term->line[term->c.y][cx].a].mode & ATTR_WDUMMY)
 		cx--;
 
-	drawregion(0, 0, term.col, term.row);
-	xdrawcursor(cx, term.c.y, term.line[term.c.y][cx],
-			term.ocx, term.ocy, term.line[term.ocy][term.ocx]);
-	term.ocx = cx;
-	term.ocy = term.c.y;
+	drawregion(term, 0, 0, term->col, term->row);
+	xdrawcursor(cx, term->c.y, term->line[term->c.y][cx],
+			term->ocx, term->ocy, term->line[term->ocy][term->ocx]);
+	term->ocx = cx;
+	term->ocy = term->c.y;
 	xfinishdraw();
-	if (ocx != term.ocx || ocy != term.ocy)
-		xximspot(term.ocx, term.ocy);
+	if (ocx != term->ocx || ocy != term->ocy)
+		xximspot(term->ocx, term->ocy);
 }
 
 void
-redraw(void)
+redraw(Term *term)
 {
-	tfulldirt();
-	draw();
+	tfulldirt(term);
+	draw(term);
 }
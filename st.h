@@ -1,8 +1,7 @@
 /* See LICENSE for license details. */
 /* Requires: stdint.h, size_t, util.h */
 
-#define ATTRCMP(a, b) ((a).mode != (b).mode || (a).fg != (b).fg || \
-                       (a).bg != (b).bg)
+#define ATTRCMP(g, h) ((g).a != (h).a)
 #define TRUECOLOR(r,g,b) (1 << 24 | (r) << 16 | (g) << 8 | (b))
 #define IS_TRUECOL(x)    (1 << 24 & (x))
 
@@ -38,36 +37,92 @@ enum selection_snap {
 	SNAP_LINE = 2
 };
 
-#define Glyph Glyph_
 typedef struct {
-	Rune u;      /* character code */
 	ushort mode; /* attribute flags */
 	uint32_t fg; /* foreground  */
 	uint32_t bg; /* background  */
+} Attr;
+
+/* A screen holds few distinct attributes: the glyphs refer to them in the
+ * attrs of their terminal, where tattr() puts each of them once */
+#define Glyph Glyph_
+typedef struct {
+	Rune u;      /* character code */
+	uint32_t a;  /* attributes, index into attrs */
 } Glyph;
 
 typedef Glyph *Line;
 
-void redraw(void);
-void draw(void);
-
-void ttogprinter(void);
-void tdump(void);
-void tdumpsel(void);
-void tsendbreak(void);
-int tattrset(int);
-void tnew(int, int);
-void tresize(int, int);
-void tsetdirtattr(int);
-void ttyhangup(void);
-int ttynew(const char *, char *, const char *, char **);
-size_t ttyread(void);
-void ttyresize(int, int);
-void ttywrite(const char *, size_t, int);
-
-void selclear(void);
-void selinit(void);
-void selstart(int, int, int);
-void selextend(int, int, int, int);
-int selected(int, int);
-char *getsel(void);
+/* Session protocol: sts sends the frontend calls of its terminal to the
+ * attached st, which sends its size back. Every message is a SessMsg header
+ * followed by len bytes. */
+enum sess_msg {
+	SESS_LINE      = 'l', /* int x1, y; SessGlyph[x2 - x1] */
+	SESS_CURSOR    = 'c', /* int x, y */
+	SESS_MODE      = 'm', /* uint set, clr, as for xmode() */
+	SESS_TITLE     = 't', /* title, "" for the default */
+	SESS_ICONTITLE = 'i', /* icon title */
+	SESS_BELL      = 'b',
+	SESS_SEL       = 's', /* selection text */
+	SESS_COLOR     = 'k', /* int index; name, "" to reset it */
+	SESS_COLORS    = 'K', /* reset all colors */
+	SESS_CURSHAPE  = 'C', /* int cursor shape */
+	SESS_POINTER   = 'p', /* int pointer motion */
+	SESS_CLIPCOPY  = 'x', /* copy the selection to the clipboard */
+	SESS_TTYMODE   = 'T', /* int tty modes, as returned by ttymode() */
+	SESS_RESIZE    = 'r', /* int cols, rows, width, height; st to sts */
+};
+
+typedef struct {
+	int type;
+	int len;
+} SessMsg;
+
+/* a glyph with its attributes, which index a table of the sender only */
+typedef struct {
+	Rune u;
+	Attr a;
+} SessGlyph;
+
+/* Terminal state: screen, modes, parser and tty */
+typedef struct Term Term;
+
+void redraw(Term *);
+void draw(Term *);
+
+void ttogprinter(Term *);
+void tdump(Term *);
+void tdumpsel(Term *);
+void tsendbreak(Term *);
+uint32_t tattr(Term *, const Attr *);
+const Attr *tattrs(Term *);
+int tattrset(Term *, int);
+Term *tnew(int, int);
+void tfree(Term *);
+void tresize(Term *, int, int);
+void tsetdirtattr(Term *, int);
+void tsetdirtcolor(Term *, int);
+int twrite(Term *, const char *, int, int);
+int ttyattach(Term *, const char *, char **);
+void ttyhangup(Term *);
+int ttymode(Term *);
+int ttynew(Term *, const char *, char *, const char *, char **);
+size_t ttyread(Term *);
+void ttyreap(void);
+void ttyrecord(Term *, const char *);
+void ttyreplay(const char *, int);
+void ttyresize(Term *, int, int);
+void ttyserve(void);
+void ttywrite(Term *, const char *, size_t, int);
+
+void selclear(Term *);
+void selstart(Term *, int, int, int);
+void selextend(Term *, int, int, int, int);
+int selected(Term *, int, int);
+int selspan(Term *, int, int *, int *);
+char *getsel(Term *);
+
+void tsearch(Term *, const Rune *, int);
+int tsearchsel(Term *);
+const char *tfound(Term *);
+
@@ -0,0 +1,61 @@
+/* See LICENSE for license details. */
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* Client for st -d: asks the server for a new window, passing the command
+ * line, working directory and environment, and returns once the server has
+ * taken them over. */
+
+extern char **environ;
+
+static void sendstr(int, const char *);
+
+void
+sendstr(int fd, const char *s)
+{
+	if (xwrite(fd, s, strlen(s) + 1) < 0)
+		die("write to server failed: %s\n", strerror(errno));
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	char cwd[PATH_MAX], n[16];
+	char **e;
+	int fd;
+
+	strcpy(sa.sun_path, sockpath(NULL));
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("socket failed: %s\n", strerror(errno));
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die("connect to %s failed: %s\n", sa.sun_path, strerror(errno));
+	if (!getcwd(cwd, sizeof(cwd)))
+		strcpy(cwd, "/");
+
+	/* cwd, argc, argv[], then the environment up to the end of stream */
+	sendstr(fd, cwd);
+	snprintf(n, sizeof(n), "%d", argc);
+	sendstr(fd, n);
+	for (; *argv; argv++)
+		sendstr(fd, *argv);
+	for (e = environ; *e; e++)
+		sendstr(fd, *e);
+	shutdown(fd, SHUT_WR);
+
+	/* the server closes the connection once it has read everything */
+	while (read(fd, n, sizeof(n)) > 0)
+		;
+
+	return 0;
+}
@@ -0,0 +1,449 @@
+/* See LICENSE for license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+char *argv0;
+#include "arg.h"
+#include "util.h"
+#include "config.h"
+#include "st.h"
+#include "win.h"
+
+/* Session server, started by st -s: owns the tty and the terminal of one
+ * session, which outlive the windows attaching to it. The frontend calls
+ * below turn into messages to the attached st, so that the output is parsed
+ * only once; on attach, st gets the modes, titles and colors, and the whole
+ * screen once it has sent its size. */
+
+static void attach(int);
+static void cleanup(void);
+static void detach(void);
+static void clientread(void);
+static void flush(void);
+static void sessmsg(int, const void *, size_t, const void *, size_t);
+static void sendint(int, int);
+static void sendstr(int, const char *);
+static void usage(void);
+
+static Term *term;
+static const char *path;
+static int ttyfd;
+static int cfd = -1;     /* attached st */
+static uint mode;        /* as set by xmode() */
+static uint modeseen;    /* all modes xmode() ever touched */
+static char *title, *icontitle;
+static int curshape = -1, pointermotion;
+static int ttymodes;     /* as last sent */
+static struct {
+	int x;
+	char *name;
+} *colors;               /* as set by xsetcolorname(), to replay them */
+static int ncolors;
+static char *out;        /* messages to cfd, sent by flush() */
+static size_t outlen, outsiz;
+
+void
+xbell(void)
+{
+	sessmsg(SESS_BELL, NULL, 0, NULL, 0);
+}
+
+void
+xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
+{
+	int a[2] = { cx, cy };
+
+	sessmsg(SESS_CURSOR, a, sizeof(a), NULL, 0);
+}
+
+void
+xdrawline(Line line, int x1, int y, int x2)
+{
+	static SessGlyph *buf;
+	static int bufsiz;
+	int a[2] = { x1, y }, x;
+	const Attr *attrs = tattrs(term);
+
+	/* the attributes are indices into our table only */
+	if (x2 - x1 > bufsiz) {
+		bufsiz = x2 - x1;
+		buf = xrealloc(buf, bufsiz * sizeof(*buf));
+	}
+	for (x = x1; x < x2; x++)
+		buf[x - x1] = (SessGlyph){ line[x].u, attrs[line[x].a] };
+	sessmsg(SESS_LINE, a, sizeof(a), buf, (x2 - x1) * sizeof(*buf));
+}
+
+void
+xfinishdraw(void)
+{
+	flush();
+}
+
+void
+xloadcolors(void)
+{
+	while (ncolors > 0)
+		free(colors[--ncolors].name);
+	sessmsg(SESS_COLORS, NULL, 0, NULL, 0);
+}
+
+int
+xsetcolorname(int x, const char *name)
+{
+	int i;
+
+	if (x < 0)
+		return 1;
+	for (i = 0; i < ncolors && colors[i].x != x; i++)
+		;
+	if (i < ncolors) {
+		free(colors[i].name);
+		colors[i] = colors[--ncolors];
+	}
+	if (name) {
+		colors = xrealloc(colors, (ncolors + 1) * sizeof(*colors));
+		colors[ncolors].x = x;
+		colors[ncolors++].name = xstrdup(name);
+	}
+	sessmsg(SESS_COLOR, &x, sizeof(x), name ? name : "",
+	        name ? strlen(name) + 1 : 1);
+	return 0;
+}
+
+void
+xseticontitle(char *p)
+{
+	free(icontitle);
+	icontitle = p ? xstrdup(p) : NULL;
+	sendstr(SESS_ICONTITLE, icontitle);
+}
+
+void
+xsettitle(char *p)
+{
+	free(title);
+	title = p ? xstrdup(p) : NULL;
+	sendstr(SESS_TITLE, title);
+}
+
+int
+xsetcursor(int cursor)
+{
+	if (!BETWEEN(cursor, 0, 7)) /* 7: st extension */
+		return 1;
+	sendint(SESS_CURSHAPE, curshape = cursor);
+	return 0;
+}
+
+void
+xsetpointermotion(int set)
+{
+	sendint(SESS_POINTER, pointermotion = set);
+}
+
+void
+xsetsel(char *str)
+{
+	sendstr(SESS_SEL, str);
+	free(str);
+}
+
+int
+xstartdraw(void)
+{
+	return cfd >= 0;
+}
+
+uint
+xmode(uint set, uint clr)
+{
+	uint a[2] = { set, clr };
+
+	mode = (~mode & set) | (mode & ~clr);
+	modeseen |= set | clr;
+	sessmsg(SESS_MODE, a, sizeof(a), NULL, 0);
+	return mode;
+}
+
+void
+xclipcopy(void)
+{
+	sessmsg(SESS_CLIPCOPY, NULL, 0, NULL, 0);
+}
+
+/* only reachable through shortcuts, which are st's business */
+
+void
+xclippaste(void)
+{ }
+
+void
+xfocuspane(int dir)
+{ }
+
+void
+xsearch(void)
+{ }
+
+void
+xselpaste(void)
+{ }
+
+void
+xsplit(int vert)
+{ }
+
+void
+xximspot(int x, int y)
+{ }
+
+void
+xzoomabs(double fontsize)
+{ }
+
+void
+xzoomrel(double delta)
+{ }
+
+void
+xzoomrst(void)
+{ }
+
+void
+sessmsg(int type, const void *a, size_t alen, const void *b, size_t blen)
+{
+	SessMsg m = { type, alen + blen };
+
+	if (cfd < 0)
+		return;
+	if (outsiz - outlen < sizeof(m) + alen + blen) {
+		outsiz = 2 * outsiz + sizeof(m) + alen + blen;
+		out = xrealloc(out, outsiz);
+	}
+	memcpy(out + outlen, &m, sizeof(m));
+	memcpy(out + outlen + sizeof(m), a, alen);
+	memcpy(out + outlen + sizeof(m) + alen, b, blen);
+	outlen += sizeof(m) + alen + blen;
+}
+
+void
+sendint(int type, int n)
+{
+	sessmsg(type, &n, sizeof(n), NULL, 0);
+}
+
+void
+sendstr(int type, const char *s)
+{
+	if (!s)
+		s = "";
+	sessmsg(type, s, strlen(s) + 1, NULL, 0);
+}
+
+void
+flush(void)
+{
+	if (cfd >= 0 && outlen > 0 && xwrite(cfd, out, outlen) < 0)
+		detach();
+	outlen = 0;
+}
+
+/* A new window takes the session over from the one attached before */
+void
+attach(int fd)
+{
+	uint a[2];
+	int i;
+
+	if (cfd >= 0)
+		detach();
+	cfd = fd;
+	fcntl(cfd, F_SETFD, FD_CLOEXEC);
+	if (sendfd(cfd, ttyfd) < 0) {
+		detach();
+		return;
+	}
+
+	a[0] = mode;
+	a[1] = modeseen & ~mode;
+	sessmsg(SESS_MODE, a, sizeof(a), NULL, 0);
+	sendstr(SESS_TITLE, title);
+	sendstr(SESS_ICONTITLE, icontitle);
+	if (curshape >= 0)
+		sendint(SESS_CURSHAPE, curshape);
+	sendint(SESS_POINTER, pointermotion);
+	sendint(SESS_TTYMODE, ttymodes = ttymode(term));
+	for (i = 0; i < ncolors; i++) {
+		sessmsg(SESS_COLOR, &colors[i].x, sizeof(int), colors[i].name,
+		        strlen(colors[i].name) + 1);
+	}
+	flush();
+}
+
+void
+detach(void)
+{
+	close(cfd);
+	cfd = -1;
+	outlen = 0;
+}
+
+void
+clientread(void)
+{
+	static char buf[64];
+	static size_t len;
+	SessMsg m;
+	int a[4], ret;
+
+	if ((ret = read(cfd, buf + len, sizeof(buf) - len)) <= 0) {
+		detach();
+		len = 0;
+		return;
+	}
+	for (len += ret; len >= sizeof(m); len -= sizeof(m) + m.len) {
+		memcpy(&m, buf, sizeof(m));
+		if (m.len < 0 || (size_t)m.len > sizeof(buf) - sizeof(m)) {
+			detach();
+			len = 0;
+			return;
+		}
+		if (len - sizeof(m) < (size_t)m.len)
+			break;
+		if (m.type == SESS_RESIZE && m.len == sizeof(a)) {
+			/* the first size is st asking for the whole screen */
+			memcpy(a, buf + sizeof(m), sizeof(a));
+			tresize(term, MAX(a[0], 1), MAX(a[1], 1));
+			ttyresize(term, a[2], a[3]);
+			redraw(term);
+		}
+		memmove(buf, buf + sizeof(m) + m.len, len - sizeof(m) - m.len);
+	}
+}
+
+void
+cleanup(void)
+{
+	unlink(path);
+}
+
+void
+usage(void)
+{
+	die("usage: %s session [command ...]\n", argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct timespec seltv, *tv, now, trigger = {0};
+	fd_set rfd;
+	int lfd, fd, maxfd, dirty;
+	mode_t mask;
+
+	ARGBEGIN {
+	default:
+		usage();
+	} ARGEND;
+
+	if (argc < 1)
+		usage();
+
+	path = strcpy(sa.sun_path, sockpath(argv[0]));
+	if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("socket failed: %s\n", strerror(errno));
+	fcntl(lfd, F_SETFD, FD_CLOEXEC);
+	unlink(sa.sun_path);
+	mask = umask(077);
+	if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die("bind %s failed: %s\n", sa.sun_path, strerror(errno));
+	umask(mask);
+	if (listen(lfd, 4) < 0)
+		die("listen failed: %s\n", strerror(errno));
+
+	/* st waits for us until we are listening */
+	switch (fork()) {
+	case -1:
+		die("fork failed: %s\n", strerror(errno));
+	case 0:
+		break;
+	default:
+		_exit(0);
+	}
+	setsid();
+	atexit(cleanup);
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(fd, 0);
+		if (fd > 2)
+			close(fd);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	/* the shell outlives the window st was started from */
+	unsetenv("WINDOWID");
+
+	setlocale(LC_CTYPE, "");
+	term = tnew(cols, rows);
+	ttyfd = ttynew(term, NULL, shell, NULL, argc > 1 ? argv + 1 : NULL);
+
+	for (dirty = 0;;) {
+		FD_ZERO(&rfd);
+		FD_SET(ttyfd, &rfd);
+		FD_SET(lfd, &rfd);
+		maxfd = MAX(ttyfd, lfd);
+		if (cfd >= 0) {
+			FD_SET(cfd, &rfd);
+			maxfd = MAX(maxfd, cfd);
+		}
+
+		/* like st, wait for minlatency of idle before drawing */
+		seltv.tv_sec = 0;
+		seltv.tv_nsec = minlatency * 1E6;
+		tv = dirty ? &seltv : NULL;
+
+		ttyreap();
+		if (pselect(maxfd+1, &rfd, NULL, NULL, tv, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("select failed: %s\n", strerror(errno));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (FD_ISSET(ttyfd, &rfd)) {
+			ttyread(term);
+			if (ttymode(term) != ttymodes)
+				sendint(SESS_TTYMODE, ttymodes = ttymode(term));
+			if (!dirty)
+				trigger = now;
+			dirty = 1;
+		}
+		if (cfd >= 0 && FD_ISSET(cfd, &rfd))
+			clientread();
+		if (FD_ISSET(lfd, &rfd) && (fd = accept(lfd, NULL, NULL)) >= 0)
+			attach(fd);
+
+		if (dirty && (!FD_ISSET(ttyfd, &rfd) ||
+		    TIMEDIFF(now, trigger) >= maxlatency)) {
+			draw(term);
+			dirty = 0;
+		}
+		flush();
+	}
+
+	return 0;
+}
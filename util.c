@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <X11/Xlib.h>
 
 #include "util.h"
@@ -16,6 +18,7 @@ static Rune utf8decbyte(char, size_t *);
 static char utf8encbyte(Rune, size_t);
 static size_t utf8validate(Rune *, size_t);
 static char base64dec_getc(const char **);
+static int hexval(int);
 static uint termkeymod(uint xmod);
 
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
@@ -84,6 +87,73 @@ xstrdup(const char *s)
 	return p;
 }
 
+/* Unix socket shared by st -d and stc, or that of the session server for
+ * session, if given */
+const char *
+sockpath(const char *session)
+{
+	static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	const char *p;
+	int n;
+
+	if ((p = getenv("ST_SOCKET")))
+		n = snprintf(path, sizeof(path), "%s", p);
+	else if ((p = getenv("XDG_RUNTIME_DIR")))
+		n = snprintf(path, sizeof(path), "%s/st", p);
+	else
+		n = snprintf(path, sizeof(path), "/tmp/st-%d", (int)getuid());
+	if (session && n >= 0 && (size_t)n < sizeof(path))
+		n += snprintf(path + n, sizeof(path) - n, "-%s", session);
+	if (n < 0 || (size_t)n >= sizeof(path))
+		die("socket path too long\n");
+
+	return path;
+}
+
+/* Pass fd over the Unix socket sock, along with a single byte */
+int
+sendfd(int sock, int fd)
+{
+	char c = 0, cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { &c, 1 };
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg;
+
+	memset(cbuf, 0, sizeof(cbuf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	return sendmsg(sock, &msg, 0) < 0 ? -1 : 0;
+}
+
+int
+recvfd(int sock)
+{
+	char c, cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { &c, 1 };
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg;
+	int fd;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	if (recvmsg(sock, &msg, 0) <= 0 || !(cmsg = CMSG_FIRSTHDR(&msg)) ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return fd;
+}
+
 ssize_t
 xwrite(int fd, const char *s, size_t len)
 {
@@ -211,6 +281,78 @@ base64dec_getc(const char **src)
 	return **src ? *((*src)++) : '=';  /* emulate padding if string ends */
 }
 
+/* Decode one asciicast v2 event line, e.g. [0.25, "o", "ls\r\n"], in place.
+ * The event data is stored at the beginning of line, its length in *len and
+ * its time offset in *t. Returns the event type, or 0 if the line is not an
+ * event (e.g. the header). */
+int
+castdec(char *line, double *t, size_t *len)
+{
+	char *p, *q;
+	int i, type;
+	Rune u, lo;
+
+	if (*line != '[')
+		return 0;
+	*t = strtod(line + 1, &p);
+	if (p == line + 1)
+		return 0;
+	p += strspn(p, ", ");
+	if (p[0] != '"' || !p[1] || p[2] != '"')
+		return 0;
+	type = p[1];
+	p += 3;
+	p += strspn(p, ", ");
+	if (*p++ != '"')
+		return 0;
+
+	for (q = line; *p && *p != '"'; ++p) {
+		if (*p != '\\') {
+			*q++ = *p;
+			continue;
+		}
+		switch (*++p) {
+		case 'b': *q++ = '\b'; break;
+		case 'f': *q++ = '\f'; break;
+		case 'n': *q++ = '\n'; break;
+		case 'r': *q++ = '\r'; break;
+		case 't': *q++ = '\t'; break;
+		case 'u':
+			for (u = 0, i = 0; i < 4 && isxdigit((uchar)p[1]); ++i)
+				u = u << 4 | hexval(*++p);
+			/* join surrogate pairs */
+			if (BETWEEN(u, 0xD800, 0xDBFF) && p[1] == '\\' &&
+			    p[2] == 'u') {
+				for (lo = 0, i = 0; i < 4 &&
+				     isxdigit((uchar)p[3 + i]); ++i)
+					lo = lo << 4 | hexval(p[3 + i]);
+				if (BETWEEN(lo, 0xDC00, 0xDFFF)) {
+					u = 0x10000 + ((u - 0xD800) << 10) +
+					    (lo - 0xDC00);
+					p += 6;
+				}
+			}
+			q += utf8enc(u, q);
+			break;
+		case '\0':
+			--p;
+			break;
+		default: /* '"', '\\' and '/' */
+			*q++ = *p;
+			break;
+		}
+	}
+	*len = q - line;
+
+	return type;
+}
+
+int
+hexval(int c)
+{
+	return isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
 size_t
 csienc(char *buf, size_t len, uint state, uint n, uint m, char c)
 {
@@ -27,8 +27,12 @@ void die(const char *, ...);
 void *xmalloc(size_t);
 void *xrealloc(void *, size_t);
 char *xstrdup(const char *);
+const char *sockpath(const char *);
+int sendfd(int, int);
+int recvfd(int);
 ssize_t xwrite(int, const char *, size_t);
 size_t utf8dec(const char *, Rune *, size_t);
 size_t utf8enc(Rune, char *);
 char *base64dec(const char *);
+int castdec(char *, double *, size_t *);
 size_t csienc(char *, size_t, uint, uint, uint, char);
@@ -31,6 +31,9 @@ enum win_mode {
 void xclipcopy(void);
 void xclippaste(void);
 void xselpaste(void);
+void xsplit(int);
+void xfocuspane(int);
+void xsearch(void);
 void xzoomabs(double);
 void xzoomrel(double);
 void xzoomrst(void);
@@ -1,5 +1,6 @@
 /* See LICENSE for license details. */
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <limits.h>
 #include <locale.h>
@@ -9,6 +10,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -29,7 +34,31 @@ char *argv0;
 #define XEMBED_FOCUS_IN  4
 #define XEMBED_FOCUS_OUT 5
 
+/* Amount of selection data fetched per XGetWindowProperty round trip, in
+ * 32-bit units */
+#define SELCHUNK (1 << 20)
+/* Selections larger than this are served in chunks of that many bytes */
+#define INCRCHUNK (1 << 18)
+
+/* Font matches kept on disk */
+#define FONTMATCHES 64
+
+/* Font sizes zoomed away from, which are kept loaded */
+#define FONTSETS 4
+
+/* The back buffer is this many pixels larger than the window, rounded,
+ * so that dragging the window larger does not recreate it every time */
+#define BUFSTEP 128
+#define BUFROUND(n) ((n) / BUFSTEP * BUFSTEP + BUFSTEP)
+
+/* the argument of an option, see options() */
+#define OPTARG(v)    if (!((v) = ARGF())) return -1
+
 #define IS_SET(flag) ((win.mode & (flag)) != 0)
+/* win_mode flags that belong to a terminal rather than to the window */
+#define PANE_MODES   (MODE_APPKEYPAD|MODE_MOUSE|MODE_MOUSESGR|MODE_REVERSE\
+                     |MODE_KBDLOCK|MODE_HIDE|MODE_APPCURSOR|MODE_8BIT\
+                     |MODE_FOCUS|MODE_BRCKTPASTE)
 #define TRUERED(x)   (((x) & 0xff0000) >> 8)
 #define TRUEGREEN(x) (((x) & 0xff00))
 #define TRUEBLUE(x)  (((x) & 0xff) << 8)
@@ -42,17 +71,35 @@ typedef XftGlyphFontSpec GlyphFontSpec;
 typedef struct {
 	int tw, th; /* tty width and height */
 	int w, h; /* window width and height */
+	int pw, ph; /* size to resize to before drawing, see resize() */
 	int ch; /* char height */
 	int cw; /* char width  */
 	uint mode; /* window state/mode flags */
 	int cursor; /* cursor style */
 } TermWindow;
 
+/* Part of the window showing one terminal. Splits are the inner nodes of
+ * the layout tree, with the separator between their two halves. */
+typedef struct Pane Pane;
+struct Pane {
+	Term *term;     /* NULL for a split */
+	int ttyfd;
+	uint mode;      /* PANE_MODES of the terminal, while it is not cur */
+	int col, row;   /* position in the window, in cells */
+	int cols, rows; /* size, in cells */
+	int vert;       /* split into panes side by side */
+	Pane *parent, *a, *b;
+	Pane *next;     /* next leaf */
+};
+
+/* The display and the window. dpy, cmap, vis, scr, pointer, the atoms and
+ * ime.xim are shared by all windows, see Win. */
 typedef struct {
 	Display *dpy;
 	Colormap cmap;
 	Window win;
 	Drawable buf;
+	int bufw, bufh; /* size of buf, at least that of the window */
 	GlyphFontSpec *specbuf; /* font spec buffer used for rendering */
 	Atom xembed, wmdeletewin, netwmname, netwmiconname, netwmpid;
 	struct {
@@ -64,15 +111,27 @@ typedef struct {
 	Draw draw;
 	Visual *vis;
 	XSetWindowAttributes attrs;
+	Cursor pointer;
 	int scr;
 	int isfixed; /* is fixed geometry? */
 	int l, t; /* left and top offset */
 	int gm; /* geometry mask */
 } XWindow;
 
+/* Selection served to a requestor chunk by chunk, with the INCR protocol */
+typedef struct Incr Incr;
+struct Incr {
+	Window win;
+	Atom property, target;
+	char *text;      /* freed with the transfer once xsel has let it go */
+	size_t len, off;
+	Incr *next;
+};
+
 typedef struct {
 	Atom xtarget;
 	char *primary, *clipboard;
+	Incr *incr;      /* transfers in progress */
 	struct timespec tclick1;
 	struct timespec tclick2;
 } XSelection;
@@ -91,35 +150,150 @@ typedef struct {
 	XftFont *match;
 	FcFontSet *set;
 	FcPattern *pattern;
+	int configured; /* pattern went through FcConfigSubstitute() */
 } Font;
 
+/* Resolving a font pattern takes loading the whole fontconfig setup and
+ * scoring every installed font, so the matches of the primary font and its
+ * variants are kept on disk. An entry is keyed by the font, its size and
+ * variant and the Xft defaults, and only used as long as the fontconfig
+ * configuration is older than the entry. */
+typedef struct {
+	char *key;
+	char *configured; /* unparsed pattern the match was resolved from */
+	char *match;    /* unparsed match pattern */
+	long mtime;     /* when it was resolved */
+	int ascent, descent, width, rbearing, badslant, badweight;
+} Fontmatch;
+
 /* Drawing Context */
 typedef struct {
-	Color *col;
+	Color *col;           /* of the current window, see Win */
+	XRenderColor *defcol; /* configured palette, see xloadcolors() */
+	char *colchanged;     /* by xsetcolorname(), see xflushcolors() */
+	int colpending;
 	size_t collen;
 	Font font, bfont, ifont, ibfont;
+	FcPattern *pattern; /* the variants are loaded from, see xloadvariant() */
+	const char *fontstr;
+	double fontsize;
 	GC gc;
 } DC;
 
+/* Font Ring Cache */
+enum {
+	FRC_NORMAL,
+	FRC_ITALIC,
+	FRC_BOLD,
+	FRC_ITALICBOLD
+};
+
+typedef struct {
+	XftFont *font;
+	int flags;
+	Rune unicodep;
+} Fontcache;
+
+/* The search typed into the active pane, see xsearch() */
+typedef struct {
+	Pane *pane; /* NULL if not searching */
+	Rune *q;
+	int len, siz;
+} Search;
+
+/* A top level window with its panes. The state of the one being handled is
+ * in the globals below, setwin() moves it here when another one takes its
+ * place. st -d has a window for each stc request, all sharing the display,
+ * the fonts and their glyph cache and the configured palette. */
+typedef struct Win Win;
+struct Win {
+	XWindow xw;
+	TermWindow win;
+	Pane *root, *panes, *active, *cur;
+	char *title;
+	Search search;
+	Color *col;
+	char *colchanged;
+	int colpending;
+	double fontsize;   /* usedfontsize */
+	char *class, *name, *deftitle; /* opt_class, opt_name, opt_title */
+	int oldbutton;
+	char *req;         /* stc request the strings point into */
+	char **argv;
+	char **env;        /* for the shells, NULL for that of st */
+	char windowid[32]; /* the first entry of env */
+	Win *next;
+};
+
+/* Everything loaded for one font size, see xzoomabs() */
+typedef struct {
+	double size;     /* usedfontsize */
+	Font font, bfont, ifont, ibfont;
+	FcPattern *pattern;
+	double fontsize; /* as passed to xloadfonts() */
+	Fontcache *frc;
+	int frclen, frccap;
+} Fontset;
+
 static inline ushort sixd_to_16bit(int);
-static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
-static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int);
-static void xdrawglyph(Glyph, int, int);
+static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *,
+                               const Attr *, int, int, int);
+static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Attr, int, int, int);
+static void xdrawglyph(Glyph, Attr, int, int);
 static void xclear(int, int, int, int);
+static void xflushcolors(void);
+static void xflushresize(void);
 static int xgeommasktogravity(int);
 static int ximopen(Display *);
 static void ximinstantiate(Display *, XPointer, XPointer);
 static void ximdestroy(XIM, XPointer, XPointer);
 static int xicdestroy(XIC, XPointer, XPointer);
-static void xinit(int, int);
+static void xicopen(void);
+static void xsetup(void);
+static void xnewwin(int, int);
+static void xstart(void);
+static void setwin(Win *);
+static void winsave(Win *);
+static void winload(Win *);
+static Win *winof(Window);
+static Pane *winpanes(Win *);
+static void closewin(void);
 static void cresize(int, int);
+static void paneinit(int, int);
+static int panetty(Pane *, const char *, const char *, char **);
+static void panefree(Pane *);
+static void setcur(Pane *);
+static void focuspane(Pane *);
+static void closepane(Pane *);
+static Pane *paneat(int, int);
+static void layout(Pane *, int, int, int, int);
+static void xdrawseps(Pane *);
+static void redrawall(void);
 static void xresize(int, int);
 static void xhints(void);
 static int xloadcolor(int, const char *, Color *);
-static int xloadfont(Font *, FcPattern *);
+static int xalloccolor(const XRenderColor *, Color *);
+static ulong xmaskcolor(ushort, ulong);
+static int xparsecolor(const char *, XRenderColor *);
+static int xloadfont(Font *, FcPattern *, const char *);
 static void xloadfonts(const char *, double);
+static Font *xloadvariant(int);
+static void xfontconfigure(Font *);
+static const char *fmcpath(void);
+static void fmcload(void);
+static void fmcsave(void);
+static void fmcflush(void);
+static Fontmatch *fmclookup(const char *);
+static int fmcopen(Font *, FcPattern *, const Fontmatch *);
+static void fmcstore(const char *, const Font *);
+static int fmcvalid(const Fontmatch *);
+static void fmcrevalidate(void);
+static void fontkey(char *, size_t, const char *, double, int);
 static void xunloadfont(Font *);
-static void xunloadfonts(void);
+static void fontsetuse(double);
+static void fontsetsave(Fontset *);
+static void fontsetload(Fontset *);
+static void fontsetfree(Fontset *);
 static void xsetenv(void);
 static void xseturgency(int);
 static int evcol(XEvent *);
@@ -130,6 +304,10 @@ static void visibility(XEvent *);
 static void unmap(XEvent *);
 static int handlesym(KeySym, uint);
 static void kaction(XKeyEvent *, int);
+static void searchkey(KeySym, const char *, size_t);
+static void searchend(int);
+static void searchtitle(void);
+static void setwmname(char *);
 static void kpress(XEvent *);
 static void krelease(XEvent *);
 static void cmessage(XEvent *);
@@ -140,14 +318,23 @@ static void brelease(XEvent *);
 static void bpress(XEvent *);
 static void bmotion(XEvent *);
 static void propnotify(XEvent *);
+static void destroynotify(XEvent *);
 static void selnotify(XEvent *);
 static void selclear_(XEvent *);
 static void selrequest(XEvent *);
 static void setsel(char *, Time);
+static void selfree(char *);
+static void incrnext(XPropertyEvent *);
+static void incrfree(Incr *, int);
+static int xerror(Display *, XErrorEvent *);
 static void mousesel(XEvent *, int);
 static void mousereport(XEvent *);
 
 static void run(void);
+static int options(int, char *[]);
+static void serve(void);
+static void xaccept(void);
+static char *recvargs(int, int *, char ***, char ***);
 static void usage(void);
 
 static void (*handler[LASTEvent])(XEvent *) = {
@@ -170,6 +357,8 @@ static void (*handler[LASTEvent])(XEvent *) = {
 	/* PropertyNotify is only turned on when there is some INCR transfer
 	 * happening for the selection retrieval. */
 	[PropertyNotify] = propnotify,
+	/* the same for the StructureNotify events of other windows */
+	[DestroyNotify] = destroynotify,
 	[SelectionRequest] = selrequest,
 };
 
@@ -177,26 +366,33 @@ static void (*handler[LASTEvent])(XEvent *) = {
 static DC dc;
 static XWindow xw;
 static XSelection xsel;
+static int (*xerrorxlib)(Display *, XErrorEvent *);
 static TermWindow win;
-
-/* Font Ring Cache */
-enum {
-	FRC_NORMAL,
-	FRC_ITALIC,
-	FRC_BOLD,
-	FRC_ITALICBOLD
-};
-
-typedef struct {
-	XftFont *font;
-	int flags;
-	Rune unicodep;
-} Fontcache;
+static Pane *root;   /* layout tree */
+static Pane *panes;  /* list of the leaves, which hold the terminals */
+static Pane *active; /* pane receiving input */
+static Pane *cur;    /* pane IS_SET() and the st.c callbacks refer to */
+static char *title;  /* as set by xsettitle(), while searching */
+static Search search;
+static Win *wins;    /* all windows */
+static Win *wcur;    /* the one the globals above are of, see setwin() */
+static int sfd = -1; /* st -d: listening for stc */
+
+/* Font matches, see Fontmatch */
+static Fontmatch *fmc = NULL;
+static int fmclen = 0;
+static int fmcloaded = 0;
+static int fmcdirty = 0;
+static long fmcmtime;
 
 /* Fontcache is an array now. A new font will be appended to the array. */
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+
+/* Font sets, most recently used first */
+static Fontset fsc[FONTSETS];
+static int fsclen = 0;
 static char *usedfont = NULL;
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
@@ -208,7 +404,21 @@ static char *opt_font  = NULL;
 static char *opt_io    = NULL;
 static char *opt_line  = NULL;
 static char *opt_name  = NULL;
+static char *opt_play  = NULL;
+static char *opt_rec   = NULL;
+static char *opt_sess  = NULL;
 static char *opt_title = NULL;
+static int opt_playfast = 0;
+static int opt_daemon = 0;
+
+/* st -d: its own options, the defaults of the windows of its clients */
+static struct {
+	char *class, **cmd, *embed, *name, *rec, *title;
+	uint cols, rows;
+	int l, t, gm, isfixed, altscreen;
+} srvopt;
+
+extern char **environ;
 
 static int oldbutton = 3; /* button event on startup: 3 = release */
 
@@ -224,7 +434,7 @@ xclipcopy(void)
 {
 	Atom clipboard;
 
-	free(xsel.clipboard);
+	selfree(xsel.clipboard);
 	xsel.clipboard = NULL;
 
 	if (xsel.primary != NULL) {
@@ -254,10 +464,12 @@ xselpaste(void)
 void
 xzoomabs(double fontsize)
 {
-	xunloadfonts();
-	xloadfonts(usedfont, fontsize);
+	if (fontsize == usedfontsize)
+		return;
+
+	fontsetuse(fontsize);
 	cresize(0, 0);
-	redraw();
+	redrawall();
 	xhints();
 }
 
@@ -277,16 +489,16 @@ xzoomrst(void)
 int
 evcol(XEvent *e)
 {
-	int x = e->xbutton.x - borderpx;
-	LIMIT(x, 0, win.tw - 1);
+	int x = e->xbutton.x - borderpx - cur->col * win.cw;
+	LIMIT(x, 0, cur->cols * win.cw - 1);
 	return x / win.cw;
 }
 
 int
 evrow(XEvent *e)
 {
-	int y = e->xbutton.y - borderpx;
-	LIMIT(y, 0, win.th - 1);
+	int y = e->xbutton.y - borderpx - cur->row * win.ch;
+	LIMIT(y, 0, cur->rows * win.ch - 1);
 	return y / win.ch;
 }
 
@@ -306,9 +518,9 @@ mousesel(XEvent *e, int done)
 		}
 	}
 
-	selextend(evcol(e), evrow(e), type, done);
+	selextend(cur->term, evcol(e), evrow(e), type, done);
 	if (done)
-		setsel(getsel(), e->xbutton.time);
+		setsel(getsel(cur->term), e->xbutton.time);
 }
 
 void
@@ -373,7 +585,7 @@ mousereport(XEvent *e)
 		return;
 	}
 
-	ttywrite(buf, len, 0);
+	ttywrite(cur->term, buf, len, 0);
 }
 
 int
@@ -385,7 +597,7 @@ baction(XButtonEvent *e, int release)
 	state = confstate(e->state, release);
 	for (b = btns; b->btn; b++) {
 		if (b->btn == e->button && MATCH(state, b->set, b->clr)) {
-			b->fn(state, b->arg);
+			b->fn(cur->term, state, b->arg);
 			return 1;
 		}
 	}
@@ -397,8 +609,11 @@ void
 bpress(XEvent *e)
 {
 	struct timespec now;
+	Pane *p;
 	int snap;
 
+	focuspane(paneat(e->xbutton.x, e->xbutton.y));
+
 	if (IS_SET(MODE_MOUSE)) {
 		mousereport(e);
 		return;
@@ -421,7 +636,12 @@ bpress(XEvent *e)
 		xsel.tclick2 = xsel.tclick1;
 		xsel.tclick1 = now;
 
-		selstart(evcol(e), evrow(e), snap);
+		/* only one pane shows the selection */
+		for (p = panes; p; p = p->next) {
+			if (p != cur)
+				selclear(p->term);
+		}
+		selstart(cur->term, evcol(e), evrow(e), snap);
 	}
 }
 
@@ -446,6 +666,11 @@ propnotify(XEvent *e)
 	Atom clipboard = XInternAtom(xw.dpy, "CLIPBOARD", 0);
 
 	xpev = &e->xproperty;
+	if (xpev->window != xw.win) {
+		if (xpev->state == PropertyDelete)
+			incrnext(xpev);
+		return;
+	}
 	if (xpev->state == PropertyNewValue &&
 			(xpev->atom == XA_PRIMARY ||
 			 xpev->atom == clipboard)) {
@@ -474,7 +699,7 @@ selnotify(XEvent *e)
 
 	do {
 		if (XGetWindowProperty(xw.dpy, xw.win, property, ofs,
-					BUFSIZ/4, False, AnyPropertyType,
+					SELCHUNK, False, AnyPropertyType,
 					&type, &format, &nitems, &rem,
 					&data)) {
 			fprintf(stderr, "clipboard allocation failed\n");
@@ -507,7 +732,9 @@ selnotify(XEvent *e)
 		/* As seen in getsel:
 		 * Line endings are inconsistent in the terminal and GUI world
 		 * copy and pasting. When receiving some selection data,
-		 * replace all '\n' with '\r'.
+		 * replace all '\n' with '\r'. The data is translated in place
+		 * and handed to ttywrite() as is, so a paste costs one memchr
+		 * scan and no copies.
 		 * FIXME: Fix the computer world. */
 		repl = data;
 		last = data + nitems * format / 8;
@@ -516,10 +743,10 @@ selnotify(XEvent *e)
 		}
 
 		if (IS_SET(MODE_BRCKTPASTE) && ofs == 0)
-			ttywrite("\033[200~", 6, 0);
-		ttywrite((char *)data, nitems * format / 8, 1);
+			ttywrite(cur->term, "\033[200~", 6, 0);
+		ttywrite(cur->term, (char *)data, last - data, 1);
 		if (IS_SET(MODE_BRCKTPASTE) && rem == 0)
-			ttywrite("\033[201~", 6, 0);
+			ttywrite(cur->term, "\033[201~", 6, 0);
 		XFree(data);
 		/* number of 32-bit chunks returned */
 		ofs += nitems * format / 32;
@@ -533,7 +760,10 @@ selnotify(XEvent *e)
 void
 selclear_(XEvent *e)
 {
-	selclear();
+	Pane *p;
+
+	for (p = panes; p; p = p->next)
+		selclear(p->term);
 }
 
 void
@@ -543,6 +773,9 @@ selrequest(XEvent *e)
 	XSelectionEvent xev;
 	Atom xa_targets, string, clipboard;
 	char *seltext;
+	size_t len;
+	long incrlen;
+	Incr *t;
 
 	xsre = (XSelectionRequestEvent *) e;
 	xev.type = SelectionNotify;
@@ -578,11 +811,38 @@ selrequest(XEvent *e)
 					xsre->selection);
 			return;
 		}
-		if (seltext != NULL) {
+		if (seltext != NULL && (len = strlen(seltext)) > INCRCHUNK &&
+		    !winof(xsre->requestor)) {
+			/* the requestor deleting the property asks for the
+			 * next chunk, see incrnext(), and destroying its
+			 * window ends the transfer; the event masks of our
+			 * windows are not to be messed with, pastes into st
+			 * get it all */
+			for (t = xsel.incr; t; t = t->next) {
+				if (t->win == xsre->requestor &&
+				    t->property == xsre->property)
+					break;
+			}
+			if (t)
+				incrfree(t, 0);
+			t = xmalloc(sizeof(*t));
+			*t = (Incr){ xsre->requestor, xsre->property,
+			             xsre->target, seltext, len, 0, xsel.incr };
+			xsel.incr = t;
+			XSelectInput(xsre->display, xsre->requestor,
+			             PropertyChangeMask | StructureNotifyMask);
+			incrlen = len;
+			XChangeProperty(xsre->display, xsre->requestor,
+					xsre->property,
+					XInternAtom(xw.dpy, "INCR", 0),
+					32, PropModeReplace,
+					(uchar *)&incrlen, 1);
+			xev.property = xsre->property;
+		} else if (seltext != NULL) {
 			XChangeProperty(xsre->display, xsre->requestor,
 					xsre->property, xsre->target,
 					8, PropModeReplace,
-					(uchar *)seltext, strlen(seltext));
+					(uchar *)seltext, len);
 			xev.property = xsre->property;
 		}
 	}
@@ -592,18 +852,105 @@ selrequest(XEvent *e)
 		fprintf(stderr, "error sending SelectionNotify event\n");
 }
 
+/* Send the next chunk of a transfer, an empty one after the last */
+void
+incrnext(XPropertyEvent *e)
+{
+	Incr *t;
+	size_t n;
+
+	for (t = xsel.incr; t; t = t->next) {
+		if (t->win == e->window && t->property == e->atom)
+			break;
+	}
+	if (!t)
+		return;
+
+	n = MIN(t->len - t->off, INCRCHUNK);
+	XChangeProperty(xw.dpy, t->win, t->property, t->target, 8,
+			PropModeReplace, (uchar *)t->text + t->off, n);
+	t->off += n;
+	if (n == 0)
+		incrfree(t, 1);
+}
+
+/* A requestor went away without asking for the rest of its transfers */
+void
+destroynotify(XEvent *e)
+{
+	Incr *t, *next;
+
+	for (t = xsel.incr; t; t = next) {
+		next = t->next;
+		if (t->win == e->xdestroywindow.window)
+			incrfree(t, 0);
+	}
+}
+
+/* End transfer t, letting go of its requestor unless told it is gone */
+void
+incrfree(Incr *t, int deselect)
+{
+	Incr **tp, *o;
+	int used = t->text == xsel.primary || t->text == xsel.clipboard;
+	int watched = 0;
+
+	for (tp = &xsel.incr; *tp != t; tp = &(*tp)->next)
+		;
+	*tp = t->next;
+	for (o = xsel.incr; o; o = o->next) {
+		used |= o->text == t->text;
+		watched |= o->win == t->win;
+	}
+	if (deselect && !watched)
+		XSelectInput(xw.dpy, t->win, NoEventMask);
+	if (!used)
+		free(t->text);
+	free(t);
+}
+
+/* Free selection text s, unless a transfer still sends it */
+void
+selfree(char *s)
+{
+	Incr *t;
+
+	for (t = xsel.incr; t; t = t->next) {
+		if (t->text == s)
+			return;
+	}
+	free(s);
+}
+
+/* A requestor that goes away in the middle of a transfer gets its
+ * DestroyNotify, but a chunk may be sent before that is read. There is no
+ * talking to the server from here, so the transfer is just forgotten. */
+int
+xerror(Display *dpy, XErrorEvent *ee)
+{
+	Incr *t;
+
+	for (t = xsel.incr; t; t = t->next) {
+		if (t->win == ee->resourceid && ee->error_code == BadWindow) {
+			incrfree(t, 0);
+			return 0;
+		}
+	}
+	return xerrorxlib(dpy, ee);
+}
+
 void
 setsel(char *str, Time t)
 {
 	if (!str)
 		return;
 
-	free(xsel.primary);
+	selfree(xsel.primary);
 	xsel.primary = str;
 
 	XSetSelectionOwner(xw.dpy, XA_PRIMARY, xw.win, t);
 	if (XGetSelectionOwner(xw.dpy, XA_PRIMARY) != xw.win)
-		selclear();
+		selclear(cur->term);
 }
 
 void
@@ -638,9 +985,380 @@ cresize(int width, int height)
 	col = MAX(1, col);
 	row = MAX(1, row);
 
-	tresize(col, row);
 	xresize(col, row);
-	ttyresize(win.tw, win.th);
+	layout(root, 0, 0, col, row);
+	xdrawseps(root);
+}
+
+/* Sets up the first pane, taking the whole window. */
+void
+paneinit(int cols, int rows)
+{
+	root = panes = active = cur = xmalloc(sizeof(*root));
+	*root = (Pane){ .term = tnew(cols, rows), .cols = cols, .rows = rows };
+}
+
+/* Starts the shell of p, in the environment and working directory of the
+ * stc request of the window */
+int
+panetty(Pane *p, const char *line, const char *out, char **cmd)
+{
+	char **env = environ;
+
+	if (wcur->env) {
+		environ = wcur->env;
+		if (chdir(wcur->req) < 0)
+			fprintf(stderr, "chdir '%s' failed: %s\n", wcur->req,
+			        strerror(errno));
+	}
+	p->ttyfd = ttynew(p->term, line, shell, out, cmd);
+	environ = env;
+
+	return p->ttyfd;
+}
+
+/* Frees the layout tree p, closing the terminals of its panes */
+void
+panefree(Pane *p)
+{
+	if (p->term) {
+		tfree(p->term);
+	} else {
+		panefree(p->a);
+		panefree(p->b);
+	}
+	free(p);
+}
+
+/* Makes p the pane IS_SET() and the callbacks from st.c refer to, by
+ * swapping the terminal part of win.mode with the one saved in p. */
+void
+setcur(Pane *p)
+{
+	if (p == cur)
+		return;
+	cur->mode = win.mode & PANE_MODES;
+	win.mode = (win.mode & ~PANE_MODES) | p->mode;
+	cur = p;
+}
+
+/* Makes w the window the globals are of, like setcur() does for panes.
+ * With w NULL, they are free for a new window. */
+void
+setwin(Win *w)
+{
+	if (w == wcur)
+		return;
+	if (wcur)
+		winsave(wcur);
+	if (w)
+		winload(w);
+	wcur = w;
+}
+
+void
+winsave(Win *w)
+{
+	w->xw = xw;
+	w->win = win;
+	w->root = root;
+	w->panes = panes;
+	w->active = active;
+	w->cur = cur;
+	w->title = title;
+	w->search = search;
+	w->col = dc.col;
+	w->colchanged = dc.colchanged;
+	w->colpending = dc.colpending;
+	w->fontsize = usedfontsize;
+	w->class = opt_class;
+	w->name = opt_name;
+	w->deftitle = opt_title;
+	w->oldbutton = oldbutton;
+}
+
+void
+winload(Win *w)
+{
+	XIM xim = xw.ime.xim;
+	XVaNestedList spotlist = xw.ime.spotlist;
+
+	xw = w->xw;
+	/* the input method may have come or gone since w was saved */
+	xw.ime.xim = xim;
+	xw.ime.spotlist = spotlist;
+	win = w->win;
+	root = w->root;
+	panes = w->panes;
+	active = w->active;
+	cur = w->cur;
+	title = w->title;
+	search = w->search;
+	dc.col = w->col;
+	dc.colchanged = w->colchanged;
+	dc.colpending = w->colpending;
+	opt_class = w->class;
+	opt_name = w->name;
+	opt_title = w->deftitle;
+	oldbutton = w->oldbutton;
+	if (w->fontsize != usedfontsize)
+		fontsetuse(w->fontsize);
+}
+
+/* The window of ours with the X window id, if any */
+Win *
+winof(Window id)
+{
+	Win *w;
+
+	for (w = wins; w; w = w->next) {
+		if (((w == wcur) ? xw.win : w->xw.win) == id)
+			break;
+	}
+	return w;
+}
+
+Pane *
+winpanes(Win *w)
+{
+	return (w == wcur) ? panes : w->panes;
+}
+
+/* Closes the current window, as st exits. st -d goes on with another
+ * window current, or none. */
+void
+closewin(void)
+{
+	Win **wp;
+	size_t i;
+
+	if (sfd < 0)
+		exit(0);
+
+	panefree(root);
+	free(title);
+	free(search.q);
+	if (xw.ime.xic)
+		XDestroyIC(xw.ime.xic);
+	XftDrawDestroy(xw.draw);
+	XFreePixmap(xw.dpy, xw.buf);
+	XDestroyWindow(xw.dpy, xw.win);
+	free(xw.specbuf);
+	for (i = 0; i < dc.collen; i++)
+		XftColorFree(xw.dpy, xw.vis, xw.cmap, &dc.col[i]);
+	free(dc.col);
+	free(dc.colchanged);
+
+	for (wp = &wins; *wp != wcur; wp = &(*wp)->next)
+		;
+	*wp = wcur->next;
+	free(wcur->req);
+	free(wcur->argv);
+	free(wcur->env);
+	free(wcur);
+
+	/* nothing refers to the window any more, its events included */
+	wcur = NULL;
+	root = panes = active = cur = NULL;
+	title = NULL;
+	search = (Search){0};
+	xw.win = None;
+	setwin(wins);
+}
+
+void
+focuspane(Pane *p)
+{
+	Pane *old = active;
+
+	if (p == active)
+		return;
+	if (search.pane)
+		searchend(0);
+	active = p;
+
+	/* the cursor of the old pane turns hollow */
+	setcur(old);
+	if (IS_SET(MODE_FOCUSED) && IS_SET(MODE_FOCUS))
+		ttywrite(old->term, "\033[O", 3, 0);
+	draw(old->term);
+
+	setcur(p);
+	if (IS_SET(MODE_FOCUSED) && IS_SET(MODE_FOCUS))
+		ttywrite(p->term, "\033[I", 3, 0);
+	xsetpointermotion(IS_SET(MODE_MOUSEMANY));
+	draw(p->term);
+}
+
+/* Removes a pane whose tty hung up; its sibling takes the place of the
+ * split. The last one takes the window with it. */
+void
+closepane(Pane *p)
+{
+	Pane *n = p->parent, *sib, **pp;
+
+	if (!n) {
+		closewin();
+		return;
+	}
+	if (search.pane == p) {
+		search.pane = NULL;
+		searchtitle();
+	}
+	sib = (n->a == p) ? n->b : n->a;
+	sib->parent = n->parent;
+	if (!n->parent)
+		root = sib;
+	else if (n->parent->a == n)
+		n->parent->a = sib;
+	else
+		n->parent->b = sib;
+
+	for (pp = &panes; *pp != p; pp = &(*pp)->next)
+		;
+	*pp = p->next;
+
+	if (active == p) {
+		for (active = sib; !active->term; active = active->a)
+			;
+	}
+	if (cur == p) {
+		win.mode = (win.mode & ~PANE_MODES) | active->mode;
+		cur = active;
+	}
+
+	tfree(p->term);
+	free(p);
+	free(n);
+	cresize(0, 0);
+	redrawall();
+}
+
+Pane *
+paneat(int x, int y)
+{
+	Pane *p = root;
+	int col = (x - borderpx) / win.cw, row = (y - borderpx) / win.ch;
+
+	while (!p->term) {
+		if (p->vert)
+			p = (col < p->b->col) ? p->a : p->b;
+		else
+			p = (row < p->b->row) ? p->a : p->b;
+	}
+	return p;
+}
+
+/* Gives p the area at col, row; the halves of a split share it evenly,
+ * apart from one cell for the separator. */
+void
+layout(Pane *p, int col, int row, int cols, int rows)
+{
+	int n;
+
+	p->col = col;
+	p->row = row;
+	p->cols = cols;
+	p->rows = rows;
+
+	if (p->term) {
+		tresize(p->term, cols, rows);
+		ttyresize(p->term, cols * win.cw, rows * win.ch);
+	} else if (p->vert) {
+		n = MAX(1, (cols - 1) / 2);
+		layout(p->a, col, row, n, rows);
+		layout(p->b, col + n + 1, row, MAX(1, cols - n - 1), rows);
+	} else {
+		n = MAX(1, (rows - 1) / 2);
+		layout(p->a, col, row, cols, n);
+		layout(p->b, col, row + n + 1, cols, MAX(1, rows - n - 1));
+	}
+}
+
+void
+xdrawseps(Pane *p)
+{
+	int x, y, w, h;
+
+	if (p->term)
+		return;
+
+	if (p->vert) {
+		x = borderpx + (p->b->col - 1) * win.cw;
+		y = borderpx + p->row * win.ch;
+		w = win.cw;
+		h = p->rows * win.ch;
+		XftDrawRect(xw.draw, &dc.col[defaultbg], x, y, w, h);
+		XftDrawRect(xw.draw, &dc.col[defaultfg], x + w / 2, y, 1, h);
+	} else {
+		x = borderpx + p->col * win.cw;
+		y = borderpx + (p->b->row - 1) * win.ch;
+		w = p->cols * win.cw;
+		h = win.ch;
+		XftDrawRect(xw.draw, &dc.col[defaultbg], x, y, w, h);
+		XftDrawRect(xw.draw, &dc.col[defaultfg], x, y + h / 2, w, 1);
+	}
+	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, x, y, w, h, x, y);
+
+	xdrawseps(p->a);
+	xdrawseps(p->b);
+}
+
+void
+redrawall(void)
+{
+	Pane *p;
+
+	xdrawseps(root);
+	for (p = panes; p; p = p->next) {
+		setcur(p);
+		redraw(p->term);
+	}
+	setcur(active);
+}
+
+void
+xsplit(int vert)
+{
+	Pane *p = active, *n, *q;
+
+	/* room for two panes and the separator */
+	if ((vert ? p->cols : p->rows) < 3)
+		return;
+
+	n = xmalloc(sizeof(*n));
+	q = xmalloc(sizeof(*q));
+	*n = (Pane){ .vert = vert, .parent = p->parent, .a = p, .b = q };
+	*q = (Pane){ .term = tnew(p->cols, p->rows), .parent = n };
+	panetty(q, NULL, NULL, NULL);
+
+	if (!p->parent)
+		root = n;
+	else if (p->parent->a == p)
+		p->parent->a = n;
+	else
+		p->parent->b = n;
+	p->parent = n;
+	q->next = p->next;
+	p->next = q;
+
+	cresize(0, 0);
+	redrawall();
+	focuspane(q);
+}
+
+void
+xfocuspane(int dir)
+{
+	Pane *p;
+
+	if (dir > 0) {
+		p = active->next ? active->next : panes;
+	} else {
+		for (p = panes; p->next && p->next != active; p = p->next)
+			;
+	}
+	focuspane(p);
 }
 
 void
@@ -649,10 +1367,16 @@ xresize(int col, int row)
 	win.tw = col * win.cw;
 	win.th = row * win.ch;
 
-	XFreePixmap(xw.dpy, xw.buf);
-	xw.buf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h,
-			DefaultDepth(xw.dpy, xw.scr));
-	XftDrawChange(xw.draw, xw.buf);
+	/* recreated when the window outgrows it or is much smaller */
+	if (win.w > xw.bufw || win.h > xw.bufh ||
+	    4 * win.w * win.h < xw.bufw * xw.bufh) {
+		xw.bufw = BUFROUND(win.w);
+		xw.bufh = BUFROUND(win.h);
+		XFreePixmap(xw.dpy, xw.buf);
+		xw.buf = XCreatePixmap(xw.dpy, xw.win, xw.bufw, xw.bufh,
+				DefaultDepth(xw.dpy, xw.scr));
+		XftDrawChange(xw.draw, xw.buf);
+	}
 	xclear(0, 0, win.w, win.h);
 
 	/* resize to new width */
@@ -665,46 +1389,99 @@ sixd_to_16bit(int x)
 	return x == 0 ? 0 : 0x3737 + 0x2828 * x;
 }
 
+/* With a TrueColor visual, pixels follow from the masks of the visual and
+ * allocating takes no round trip to the server */
+int
+xalloccolor(const XRenderColor *c, Color *ncolor)
+{
+	if (xw.vis->class != TrueColor)
+		return XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, c, ncolor);
+
+	/* the same pixel XftColorAllocValue() works out */
+	ncolor->pixel = xmaskcolor(c->red, xw.vis->red_mask) |
+	                xmaskcolor(c->green, xw.vis->green_mask) |
+	                xmaskcolor(c->blue, xw.vis->blue_mask);
+	ncolor->color = *c;
+
+	return 1;
+}
+
+ulong
+xmaskcolor(ushort v, ulong mask)
+{
+	int shift, len;
+
+	for (shift = 0; mask && !(mask & 1); shift++)
+		mask >>= 1;
+	for (len = 0; mask & 1; len++)
+		mask >>= 1;
+
+	return len ? (ulong)(v >> (16 - MIN(len, 16))) << shift : 0;
+}
+
+int
+xparsecolor(const char *name, XRenderColor *c)
+{
+	XColor xc;
+
+	if (!XParseColor(xw.dpy, xw.cmap, name, &xc))
+		return 0;
+	*c = (XRenderColor){ xc.red, xc.green, xc.blue, 0xffff };
+
+	return 1;
+}
+
 int
 xloadcolor(int i, const char *name, Color *ncolor)
 {
-	XRenderColor color = { .alpha = 0xffff };
+	XRenderColor color;
 
-	if (!name) {
-		if (BETWEEN(i, 16, 255)) { /* 256 color */
-			if (i < 6*6*6+16) { /* same colors as xterm */
-				color.red   = sixd_to_16bit( ((i-16)/36)%6 );
-				color.green = sixd_to_16bit( ((i-16)/6) %6 );
-				color.blue  = sixd_to_16bit( ((i-16)/1) %6 );
-			} else { /* greyscale */
-				color.red = 0x0808 + 0x0a0a * (i - (6*6*6+16));
-				color.green = color.blue = color.red;
-			}
-			return XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &color, ncolor);
-		} else {
-			name = colorname[i];
-		}
-	}
+	if (name)
+		return xparsecolor(name, &color) && xalloccolor(&color, ncolor);
 
-	return XftColorAllocName(xw.dpy, xw.vis, xw.cmap, name, ncolor);
+	return xalloccolor(&dc.defcol[i], ncolor);
 }
 
+/* The configured palette is worked out once, for all windows; after that a
+ * reset of the colors needs the server for non-TrueColor visuals only */
 void
 xloadcolors(void)
 {
 	int i;
-	static int loaded;
 	Color *cp;
 	const char **c;
+	XRenderColor *v;
 
-	if (loaded) {
-		for (cp = dc.col; cp < &dc.col[dc.collen]; ++cp)
-			XftColorFree(xw.dpy, xw.vis, xw.cmap, cp);
-	} else {
+	if (!dc.defcol) {
 		dc.collen = 256;
 		for (c = &colorname[256]; *c; c++)
 			dc.collen++;
+		dc.defcol = xmalloc(dc.collen * sizeof(XRenderColor));
+
+		for (i = 0, v = dc.defcol; i < dc.collen; i++, v++) {
+			*v = (XRenderColor){ .alpha = 0xffff };
+			if (!BETWEEN(i, 16, 255)) {
+				if (!colorname[i] || !xparsecolor(colorname[i], v))
+					die("allocate color '%s' failed\n",
+					    colorname[i] ? colorname[i] : "(null)");
+			} else if (i < 6*6*6+16) { /* same colors as xterm */
+				v->red   = sixd_to_16bit( ((i-16)/36)%6 );
+				v->green = sixd_to_16bit( ((i-16)/6) %6 );
+				v->blue  = sixd_to_16bit( ((i-16)/1) %6 );
+			} else { /* greyscale */
+				v->red = 0x0808 + 0x0a0a * (i - (6*6*6+16));
+				v->green = v->blue = v->red;
+			}
+		}
+	}
+
+	if (dc.col) {
+		for (cp = dc.col; cp < &dc.col[dc.collen]; ++cp)
+			XftColorFree(xw.dpy, xw.vis, xw.cmap, cp);
+	} else {
 		dc.col = xmalloc(dc.collen * sizeof(Color));
+		dc.colchanged = xmalloc(dc.collen);
+		memset(dc.colchanged, 0, dc.collen);
 	}
 
 	for (i = 0; i < dc.collen; i++) {
@@ -715,7 +1492,6 @@ xloadcolors(void)
 				die("allocate color %d failed\n", i);
 		}
 	}
-	loaded = 1;
 }
 
 int
@@ -723,7 +1499,7 @@ xsetcolorname(int x, const char *name)
 {
 	Color ncolor;
 
-	if (!BETWEEN(x, 0, dc.collen))
+	if (!BETWEEN(x, 0, dc.collen - 1))
 		return 1;
 
 	if (!xloadcolor(x, name, &ncolor))
@@ -732,9 +1508,49 @@ xsetcolorname(int x, const char *name)
 	XftColorFree(xw.dpy, xw.vis, xw.cmap, &dc.col[x]);
 	dc.col[x] = ncolor;
 
+	/* themes set dozens of colors in a row: what shows them is looked
+	 * for once, before the next frame */
+	dc.colchanged[x] = 1;
+	dc.colpending = 1;
+
 	return 0;
 }
 
+void
+xflushresize(void)
+{
+	if (win.pw == 0)
+		return;
+	if (win.pw != win.w || win.ph != win.h)
+		cresize(win.pw, win.ph);
+	win.pw = win.ph = 0;
+}
+
+/* The palette is shared by the panes of a window: mark what shows the
+ * colors changed since the last frame to be drawn again */
+void
+xflushcolors(void)
+{
+	Pane *p;
+	size_t i;
+
+	if (!dc.colpending)
+		return;
+	dc.colpending = 0;
+
+	for (i = 0; i < dc.collen; i++) {
+		if (!dc.colchanged[i])
+			continue;
+		dc.colchanged[i] = 0;
+		if (i == defaultbg) {
+			xclear(0, 0, win.w, win.h);
+			xdrawseps(root);
+		}
+		for (p = panes; p; p = p->next)
+			tsetdirtcolor(p->term, i);
+	}
+}
+
 /* Absolute coordinates. */
 void
 xclear(int x1, int y1, int x2, int y2)
@@ -795,14 +1611,20 @@ xgeommasktogravity(int mask)
 }
 
 int
-xloadfont(Font *f, FcPattern *pattern)
+xloadfont(Font *f, FcPattern *pattern, const char *key)
 {
 	FcPattern *configured;
 	FcPattern *match;
 	FcResult result;
 	XGlyphInfo extents;
+	Fontmatch *fm;
 	int wantattr, haveattr;
 
+	if ((fm = fmclookup(key)) && !fmcopen(f, pattern, fm))
+		return 0;
+	if (!FcInit())
+		die("fontconfig init failed\n");
+
 	/* Manually configure instead of calling XftMatchFont so that we can use
 	 * the configured pattern for "missing glyph" lookups. */
 	configured = FcPatternDuplicate(pattern);
@@ -850,6 +1672,7 @@ xloadfont(Font *f, FcPattern *pattern)
 
 	f->set = NULL;
 	f->pattern = configured;
+	f->configured = 1;
 
 	f->ascent = f->match->ascent;
 	f->descent = f->match->descent;
@@ -859,14 +1682,329 @@ xloadfont(Font *f, FcPattern *pattern)
 	f->height = f->ascent + f->descent;
 	f->width = DIVCEIL(extents.xOff, strlen(ascii_printable));
 
+	fmcstore(key, f);
+
+	return 0;
+}
+
+/* Fonts opened from a cached match skip the substitutions, which are only
+ * needed once fallback fonts are looked up */
+void
+xfontconfigure(Font *f)
+{
+	if (f->configured)
+		return;
+	FcConfigSubstitute(NULL, f->pattern, FcMatchPattern);
+	XftDefaultSubstitute(xw.dpy, xw.scr, f->pattern);
+	f->configured = 1;
+}
+
+const char *
+fmcpath(void)
+{
+	static char path[PATH_MAX];
+	const char *p;
+	int n;
+
+	if ((p = getenv("XDG_CACHE_HOME")))
+		n = snprintf(path, sizeof(path), "%s/st-fonts", p);
+	else if ((p = getenv("HOME")))
+		n = snprintf(path, sizeof(path), "%s/.cache/st-fonts", p);
+	else
+		return NULL;
+
+	return (n < 0 || (size_t)n >= sizeof(path)) ? NULL : path;
+}
+
+void
+fmcload(void)
+{
+	static const char *conf[] = {
+		"/etc/fonts/fonts.conf", "/etc/fonts/conf.d", "fontconfig",
+		"fontconfig/fonts.conf", "fontconfig/conf.d",
+	};
+	char path[PATH_MAX], *line, *key, *num, *cfg, *match;
+	const char *p, *home = getenv("HOME");
+	size_t len, siz = BUFSIZ;
+	struct stat st;
+	Fontmatch fm;
+	FILE *fp;
+	size_t i;
+
+	fmcloaded = 1;
+
+	/* entries are stale once any of the configuration changed */
+	if ((p = getenv("FONTCONFIG_FILE")) && !stat(p, &st))
+		fmcmtime = MAX(fmcmtime, st.st_mtime);
+	for (i = 0; i < LEN(conf); i++) {
+		if (conf[i][0] == '/')
+			snprintf(path, sizeof(path), "%s", conf[i]);
+		else if ((p = getenv("XDG_CONFIG_HOME")))
+			snprintf(path, sizeof(path), "%s/%s", p, conf[i]);
+		else if (home)
+			snprintf(path, sizeof(path), "%s/.config/%s", home, conf[i]);
+		else
+			continue;
+		if (!stat(path, &st))
+			fmcmtime = MAX(fmcmtime, st.st_mtime);
+	}
+
+	if (!(p = fmcpath()) || !(fp = fopen(p, "r")))
+		return;
+	/* key \t mtime ascent descent width rbearing badslant badweight \t
+	 * configured \t match, the charset making for long lines */
+	line = xmalloc(siz);
+	len = 0;
+	while (fgets(line + len, siz - len, fp)) {
+		len += strlen(line + len);
+		if (line[len - 1] != '\n' && !feof(fp)) {
+			line = xrealloc(line, siz *= 2);
+			continue;
+		}
+		len = 0;
+		line[strcspn(line, "\n")] = '\0';
+		key = line;
+		if (!(num = strchr(key, '\t')) || !(cfg = strchr(num + 1, '\t')) ||
+		    !(match = strchr(cfg + 1, '\t')))
+			continue;
+		*num++ = *cfg++ = *match++ = '\0';
+		if (sscanf(num, "%ld %d %d %d %d %d %d", &fm.mtime, &fm.ascent,
+		           &fm.descent, &fm.width, &fm.rbearing, &fm.badslant,
+		           &fm.badweight) != 7 || fm.mtime < fmcmtime)
+			continue;
+		fm.key = xstrdup(key);
+		fm.configured = xstrdup(cfg);
+		fm.match = xstrdup(match);
+		fmc = xrealloc(fmc, ++fmclen * sizeof(*fmc));
+		fmc[fmclen - 1] = fm;
+	}
+	free(line);
+	fclose(fp);
+}
+
+/* Written to a temporary file first, as other instances read it at the
+ * same time */
+void
+fmcsave(void)
+{
+	char tmp[PATH_MAX + 16], *dir;
+	const char *path;
+	FILE *fp;
+	int i;
+
+	if (!(path = fmcpath()))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	if ((dir = strrchr(tmp, '/'))) {
+		*dir = '\0';
+		mkdir(tmp, 0700);
+	}
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if (!(fp = fopen(tmp, "w")))
+		return;
+	for (i = MAX(fmclen - FONTMATCHES, 0); i < fmclen; i++) {
+		fprintf(fp, "%s\t%ld %d %d %d %d %d %d\t%s\t%s\n", fmc[i].key,
+		        fmc[i].mtime, fmc[i].ascent, fmc[i].descent,
+		        fmc[i].width, fmc[i].rbearing, fmc[i].badslant,
+		        fmc[i].badweight, fmc[i].configured, fmc[i].match);
+	}
+	if (fclose(fp) || rename(tmp, path))
+		unlink(tmp);
+}
+
+/* Save the matches xloadvariant() added, on exit */
+void
+fmcflush(void)
+{
+	if (fmcdirty) {
+		fmcsave();
+		fmcdirty = 0;
+	}
+}
+
+Fontmatch *
+fmclookup(const char *key)
+{
+	int i;
+
+	if (!fmcloaded)
+		fmcload();
+	for (i = 0; i < fmclen; i++) {
+		if (!strcmp(fmc[i].key, key))
+			return &fmc[i];
+	}
+	return NULL;
+}
+
+int
+fmcopen(Font *f, FcPattern *pattern, const Fontmatch *fm)
+{
+	FcPattern *match;
+
+	if (!(match = FcNameParse((const FcChar8 *)fm->match)))
+		return 1;
+	/* the font file might be gone by now */
+	if (!(f->match = XftFontOpenPattern(xw.dpy, match))) {
+		FcPatternDestroy(match);
+		return 1;
+	}
+
+	f->set = NULL;
+	f->pattern = FcPatternDuplicate(pattern);
+	f->configured = 0;
+	f->badslant = fm->badslant;
+	f->badweight = fm->badweight;
+
+	f->ascent = fm->ascent;
+	f->descent = fm->descent;
+	f->lbearing = 0;
+	f->rbearing = fm->rbearing;
+
+	f->height = f->ascent + f->descent;
+	f->width = fm->width;
+
 	return 0;
 }
 
+void
+fmcstore(const char *key, const Font *f)
+{
+	Fontmatch *fm;
+	FcChar8 *match, *configured;
+
+	if (!(match = FcNameUnparse(f->match->pattern)))
+		return;
+	if (!(configured = FcNameUnparse(f->pattern))) {
+		free(match);
+		return;
+	}
+	if (!(fm = fmclookup(key))) {
+		fmc = xrealloc(fmc, ++fmclen * sizeof(*fmc));
+		fm = &fmc[fmclen - 1];
+		fm->key = xstrdup(key);
+	} else {
+		free(fm->configured);
+		free(fm->match);
+	}
+	fm->configured = xstrdup((char *)configured);
+	fm->match = xstrdup((char *)match);
+	free(configured);
+	free(match);
+	fmcdirty = 1;
+	fm->mtime = MAX(fmcmtime, time(NULL));
+	fm->ascent = f->ascent;
+	fm->descent = f->descent;
+	fm->width = f->width;
+	fm->rbearing = f->rbearing;
+	fm->badslant = f->badslant;
+	fm->badweight = f->badweight;
+}
+
+/* Whether the configured pattern of fm still resolves to the same font */
+int
+fmcvalid(const Fontmatch *fm)
+{
+	FcPattern *configured, *match, *old;
+	FcChar8 *file, *oldfile;
+	FcResult result;
+	int index, oldindex, valid = 0;
+
+	if (!(configured = FcNameParse((const FcChar8 *)fm->configured)))
+		return 0;
+	if (!(old = FcNameParse((const FcChar8 *)fm->match))) {
+		FcPatternDestroy(configured);
+		return 0;
+	}
+	if ((match = FcFontMatch(NULL, configured, &result))) {
+		valid = FcPatternGetString(match, FC_FILE, 0, &file) ==
+		        FcResultMatch &&
+		        FcPatternGetString(old, FC_FILE, 0, &oldfile) ==
+		        FcResultMatch && !strcmp((char *)file, (char *)oldfile);
+		if (FcPatternGetInteger(match, FC_INDEX, 0, &index) !=
+		    FcResultMatch)
+			index = 0;
+		if (FcPatternGetInteger(old, FC_INDEX, 0, &oldindex) !=
+		    FcResultMatch)
+			oldindex = 0;
+		valid &= index == oldindex;
+		FcPatternDestroy(match);
+	}
+	FcPatternDestroy(configured);
+	FcPatternDestroy(old);
+
+	return valid;
+}
+
+/* Cached matches are resolved again in the background, so that newly
+ * installed fonts get picked up by the next st. The patterns they were
+ * resolved from are cached with them, so fontconfig alone does: entries
+ * that now resolve to another font are dropped, and resolved afresh with
+ * the display by the next st. */
+void
+fmcrevalidate(void)
+{
+	pid_t pid;
+	int fd, i, n;
+
+	switch (pid = fork()) {
+	case -1:
+		return;
+	case 0:
+		if (fork() != 0)
+			_exit(0);
+		/* the ttys, the display and st's handlers are not ours;
+		 * select() keeps all of st's descriptors below FD_SETSIZE */
+		for (fd = 3; fd < FD_SETSIZE; fd++)
+			close(fd);
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGALRM, SIG_DFL);
+		if (!FcInit())
+			_exit(1);
+		for (i = n = 0; i < fmclen; i++) {
+			if (fmcvalid(&fmc[i]))
+				fmc[n++] = fmc[i];
+		}
+		if (n < fmclen) {
+			fmclen = n;
+			fmcsave();
+		}
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+void
+fontkey(char *key, size_t len, const char *fontstr, double fontsize,
+        int variant)
+{
+	static const char *res[] = {
+		"dpi", "antialias", "rgba", "hinting", "hintstyle", "autohint",
+		"lcdfilter",
+	};
+	const char *v;
+	size_t i;
+	int n;
+
+	n = snprintf(key, len, "%s:%g:%d:%.2f", fontstr, fontsize, variant,
+	             DisplayHeight(xw.dpy, xw.scr) * 25.4 /
+	             DisplayHeightMM(xw.dpy, xw.scr));
+	for (i = 0; i < LEN(res) && n >= 0 && (size_t)n < len; i++) {
+		v = XGetDefault(xw.dpy, "Xft", res[i]);
+		n += snprintf(key + n, len - n, ":%s", v ? v : "");
+	}
+}
+
 void
 xloadfonts(const char *fontstr, double fontsize)
 {
+	static int revalidated;
 	FcPattern *pattern;
 	double fontval;
+	char key[1024];
 
 	if (fontstr[0] == '-')
 		pattern = XftXlfdParse(fontstr, False, False);
@@ -897,7 +2035,8 @@ xloadfonts(const char *fontstr, double fontsize)
 		defaultfontsize = usedfontsize;
 	}
 
-	if (xloadfont(&dc.font, pattern))
+	fontkey(key, sizeof(key), fontstr, fontsize, 0);
+	if (xloadfont(&dc.font, pattern, key))
 		die("open font '%s' failed\n", fontstr);
 
 	if (usedfontsize < 0) {
@@ -911,51 +2050,155 @@ xloadfonts(const char *fontstr, double fontsize)
 	win.cw = ceilf(dc.font.width * cwscale);
 	win.ch = ceilf(dc.font.height * chscale);
 
-	FcPatternDel(pattern, FC_SLANT);
-	FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ITALIC);
-	if (xloadfont(&dc.ifont, pattern))
-		die("open font '%s' failed\n", fontstr);
+	dc.pattern = pattern;
+	dc.fontstr = fontstr;
+	dc.fontsize = fontsize;
 
-	FcPatternDel(pattern, FC_WEIGHT);
-	FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_BOLD);
-	if (xloadfont(&dc.ibfont, pattern))
-		die("open font '%s' failed\n", fontstr);
+	if (fmcdirty) {
+		fmcsave();
+		fmcdirty = 0;
+	} else if (!revalidated) {
+		fmcrevalidate();
+	}
+	revalidated = 1;
+}
+
+/* Many terminals never show italic or bold text, so the variants are only
+ * loaded once they are drawn. */
+Font *
+xloadvariant(int flags)
+{
+	FcPattern *pattern;
+	Font *f;
+	char key[1024];
+
+	switch (flags) {
+	case FRC_ITALIC:
+		f = &dc.ifont;
+		break;
+	case FRC_BOLD:
+		f = &dc.bfont;
+		break;
+	case FRC_ITALICBOLD:
+		f = &dc.ibfont;
+		break;
+	default:
+		return &dc.font;
+	}
+	if (f->match)
+		return f;
 
+	if (!(pattern = FcPatternDuplicate(dc.pattern)))
+		die("open font '%s' failed\n", dc.fontstr);
 	FcPatternDel(pattern, FC_SLANT);
-	FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
-	if (xloadfont(&dc.bfont, pattern))
-		die("open font '%s' failed\n", fontstr);
+	FcPatternAddInteger(pattern, FC_SLANT, (flags != FRC_BOLD) ?
+	                    FC_SLANT_ITALIC : FC_SLANT_ROMAN);
+	if (flags != FRC_ITALIC) {
+		FcPatternDel(pattern, FC_WEIGHT);
+		FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_BOLD);
+	}
 
+	fontkey(key, sizeof(key), dc.fontstr, dc.fontsize, flags);
+	if (xloadfont(f, pattern, key))
+		die("open font '%s' failed\n", dc.fontstr);
 	FcPatternDestroy(pattern);
+	/* this is in the middle of a frame: fmcflush() saves the match */
+
+	return f;
 }
 
 void
 xunloadfont(Font *f)
 {
+	if (!f->match)
+		return;
 	XftFontClose(xw.dpy, f->match);
 	FcPatternDestroy(f->pattern);
 	if (f->set)
 		FcFontSetDestroy(f->set);
+	*f = (Font){0};
+}
+
+/* Makes the fonts of fontsize the current ones. Zooming back and forth
+ * between a few sizes is common, and so are windows of st -d in different
+ * sizes, so the fonts of the last sizes stay loaded, fallback fonts
+ * included. */
+void
+fontsetuse(double fontsize)
+{
+	Fontset fs;
+	int i;
+
+	for (i = 0; i < fsclen && fsc[i].size != fontsize; i++)
+		;
+	fontsetsave(&fs);
+	if (i < fsclen) {
+		fontsetload(&fsc[i]);
+		memmove(&fsc[i], &fsc[i + 1], (--fsclen - i) * sizeof(*fsc));
+	} else {
+		xloadfonts(usedfont, fontsize);
+	}
+	if (fsclen == FONTSETS)
+		fontsetfree(&fsc[--fsclen]);
+	memmove(&fsc[1], &fsc[0], fsclen++ * sizeof(*fsc));
+	fsc[0] = fs;
+}
+
+/* Moves the current fonts to fs */
+void
+fontsetsave(Fontset *fs)
+{
+	*fs = (Fontset){
+		.size = usedfontsize,
+		.font = dc.font, .bfont = dc.bfont,
+		.ifont = dc.ifont, .ibfont = dc.ibfont,
+		.pattern = dc.pattern, .fontsize = dc.fontsize,
+		.frc = frc, .frclen = frclen, .frccap = frccap,
+	};
+	dc.font = dc.bfont = dc.ifont = dc.ibfont = (Font){0};
+	dc.pattern = NULL;
+	frc = NULL;
+	frclen = frccap = 0;
+}
+
+void
+fontsetload(Fontset *fs)
+{
+	usedfontsize = fs->size;
+	dc.font = fs->font;
+	dc.bfont = fs->bfont;
+	dc.ifont = fs->ifont;
+	dc.ibfont = fs->ibfont;
+	dc.pattern = fs->pattern;
+	dc.fontsize = fs->fontsize;
+	frc = fs->frc;
+	frclen = fs->frclen;
+	frccap = fs->frccap;
+
+	win.cw = ceilf(dc.font.width * cwscale);
+	win.ch = ceilf(dc.font.height * chscale);
 }
 
 void
-xunloadfonts(void)
+fontsetfree(Fontset *fs)
 {
 	/* Free the loaded fonts in the font cache.  */
-	while (frclen > 0)
-		XftFontClose(xw.dpy, frc[--frclen].font);
+	while (fs->frclen > 0)
+		XftFontClose(xw.dpy, fs->frc[--fs->frclen].font);
+	free(fs->frc);
 
-	xunloadfont(&dc.font);
-	xunloadfont(&dc.bfont);
-	xunloadfont(&dc.ifont);
-	xunloadfont(&dc.ibfont);
+	xunloadfont(&fs->font);
+	xunloadfont(&fs->bfont);
+	xunloadfont(&fs->ifont);
+	xunloadfont(&fs->ibfont);
+	FcPatternDestroy(fs->pattern);
 }
 
 int
 ximopen(Display *dpy)
 {
 	XIMCallback imdestroy = { .client_data = NULL, .callback = ximdestroy };
-	XICCallback icdestroy = { .client_data = NULL, .callback = xicdestroy };
+	Win *w, *old = wcur;
 
 	xw.ime.xim = XOpenIM(xw.dpy, NULL, NULL, NULL);
 	if (xw.ime.xim == NULL)
@@ -967,17 +2210,31 @@ ximopen(Display *dpy)
 	xw.ime.spotlist = XVaCreateNestedList(0, XNSpotLocation,
 			&xw.ime.spot, NULL);
 
-	if (xw.ime.xic == NULL) {
-		xw.ime.xic = XCreateIC(xw.ime.xim, XNInputStyle,
-				XIMPreeditNothing | XIMStatusNothing, XNClientWindow, xw.win,
-				XNDestroyCallback, &icdestroy, NULL);
-		if (xw.ime.xic == NULL)
-			fprintf(stderr, "XCreateIC: failed to create input context\n");
+	for (w = wins; w; w = w->next) {
+		setwin(w);
+		xicopen();
 	}
+	setwin(old);
 
 	return 1;
 }
 
+/* Creates the input context of the current window */
+void
+xicopen(void)
+{
+	XICCallback icdestroy = { .client_data = (XPointer)wcur,
+	                          .callback = xicdestroy };
+
+	if (xw.ime.xic != NULL)
+		return;
+	xw.ime.xic = XCreateIC(xw.ime.xim, XNInputStyle,
+			XIMPreeditNothing | XIMStatusNothing, XNClientWindow, xw.win,
+			XNDestroyCallback, &icdestroy, NULL);
+	if (xw.ime.xic == NULL)
+		fprintf(stderr, "XCreateIC: failed to create input context\n");
+}
+
 void
 ximinstantiate(Display *dpy, XPointer client, XPointer call)
 {
@@ -995,38 +2252,117 @@ ximdestroy(XIM xim, XPointer client, XPointer call)
 	XFree(xw.ime.spotlist);
 }
 
+/* client is the window of the context */
 int
 xicdestroy(XIC xim, XPointer client, XPointer call)
 {
-	xw.ime.xic = NULL;
+	Win *w = (Win *)client;
+
+	if (w == wcur)
+		xw.ime.xic = NULL;
+	else
+		w->xw.ime.xic = NULL;
 	return 1;
 }
 
+/* Sets up what all windows share: the display, fonts, GC, mouse cursor,
+ * atoms and input method */
 void
-xinit(int cols, int rows)
+xsetup(void)
 {
 	XGCValues gcvalues;
-	Cursor cursor;
-	Window parent;
-	pid_t thispid = getpid();
 	XColor xmousefg, xmousebg;
 
 	if (!(xw.dpy = XOpenDisplay(NULL)))
 		die("open display failed\n");
+	xerrorxlib = XSetErrorHandler(xerror);
 	xw.scr = XDefaultScreen(xw.dpy);
 	xw.vis = XDefaultVisual(xw.dpy, xw.scr);
 
-	/* font */
-	if (!FcInit())
-		die("fontconfig init failed\n");
-
+	/* font, fontconfig is only set up if there is no cached match */
 	usedfont = (opt_font == NULL) ? font : opt_font;
 	xloadfonts(usedfont, 0);
+	atexit(fmcflush);
 
-	/* colors */
 	xw.cmap = XDefaultColormap(xw.dpy, xw.scr);
+
+	memset(&gcvalues, 0, sizeof(gcvalues));
+	gcvalues.graphics_exposures = False;
+	dc.gc = XCreateGC(xw.dpy, XRootWindow(xw.dpy, xw.scr),
+			GCGraphicsExposures, &gcvalues);
+
+	/* white cursor, black outline */
+	xw.pointer = XCreateFontCursor(xw.dpy, mouseshape);
+
+	if (XParseColor(xw.dpy, xw.cmap, colorname[mousefg], &xmousefg) == 0) {
+		xmousefg.red   = 0xffff;
+		xmousefg.green = 0xffff;
+		xmousefg.blue  = 0xffff;
+	}
+
+	if (XParseColor(xw.dpy, xw.cmap, colorname[mousebg], &xmousebg) == 0) {
+		xmousebg.red   = 0x0000;
+		xmousebg.green = 0x0000;
+		xmousebg.blue  = 0x0000;
+	}
+
+	XRecolorCursor(xw.dpy, xw.pointer, &xmousefg, &xmousebg);
+
+	xw.xembed = XInternAtom(xw.dpy, "_XEMBED", False);
+	xw.wmdeletewin = XInternAtom(xw.dpy, "WM_DELETE_WINDOW", False);
+	xw.netwmname = XInternAtom(xw.dpy, "_NET_WM_NAME", False);
+	xw.netwmiconname = XInternAtom(xw.dpy, "_NET_WM_ICON_NAME", False);
+	xw.netwmpid = XInternAtom(xw.dpy, "_NET_WM_PID", False);
+
+	/* input methods */
+	if (!ximopen(xw.dpy))
+		XRegisterIMInstantiateCallback(xw.dpy, NULL, NULL, NULL,
+				ximinstantiate, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &xsel.tclick1);
+	clock_gettime(CLOCK_MONOTONIC, &xsel.tclick2);
+	xsel.primary = NULL;
+	xsel.clipboard = NULL;
+	xsel.xtarget = XInternAtom(xw.dpy, "UTF8_STRING", 0);
+	if (xsel.xtarget == None)
+		xsel.xtarget = XA_STRING;
+}
+
+/* Opens a window of cols x rows cells with one pane, as the options say,
+ * and makes it the current one. The font size, palette, title and modes
+ * start afresh, whatever those of the other windows are. */
+void
+xnewwin(int cols, int rows)
+{
+	Win *w = xmalloc(sizeof(*w));
+	Window parent;
+	pid_t thispid = getpid();
+
+	setwin(NULL);
+	*w = (Win){ .next = wins };
+	wins = wcur = w;
+
+	if (usedfontsize != defaultfontsize)
+		fontsetuse(defaultfontsize);
+	win = (TermWindow){
+		.cw = ceilf(dc.font.width * cwscale),
+		.ch = ceilf(dc.font.height * chscale),
+	};
+	xsetcursor(cursorshape);
+	title = NULL;
+	search = (Search){0};
+	oldbutton = 3;
+
+	/* colors */
+	dc.col = NULL;
+	dc.colchanged = NULL;
+	dc.colpending = 0;
 	xloadcolors();
 
+	cols = MAX(cols, 1);
+	rows = MAX(rows, 1);
+	paneinit(cols, rows);
+
 	/* adjust fixed window geometry */
 	win.w = 2 * borderpx + cols * win.cw;
 	win.h = 2 * borderpx + rows * win.ch;
@@ -1051,11 +2387,9 @@ xinit(int cols, int rows)
 			xw.vis, CWBackPixel | CWBorderPixel | CWBitGravity
 			| CWEventMask | CWColormap, &xw.attrs);
 
-	memset(&gcvalues, 0, sizeof(gcvalues));
-	gcvalues.graphics_exposures = False;
-	dc.gc = XCreateGC(xw.dpy, parent, GCGraphicsExposures,
-			&gcvalues);
-	xw.buf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h,
+	xw.bufw = BUFROUND(win.w);
+	xw.bufh = BUFROUND(win.h);
+	xw.buf = XCreatePixmap(xw.dpy, xw.win, xw.bufw, xw.bufh,
 			DefaultDepth(xw.dpy, xw.scr));
 	XSetForeground(xw.dpy, dc.gc, dc.col[defaultbg].pixel);
 	XFillRectangle(xw.dpy, xw.buf, dc.gc, 0, 0, win.w, win.h);
@@ -1067,35 +2401,12 @@ xinit(int cols, int rows)
 	xw.draw = XftDrawCreate(xw.dpy, xw.buf, xw.vis, xw.cmap);
 
 	/* input methods */
-	if (!ximopen(xw.dpy))
-		XRegisterIMInstantiateCallback(xw.dpy, NULL, NULL, NULL,
-				ximinstantiate, NULL);
-
-	/* white cursor, black outline */
-	cursor = XCreateFontCursor(xw.dpy, mouseshape);
-	XDefineCursor(xw.dpy, xw.win, cursor);
-
-	if (XParseColor(xw.dpy, xw.cmap, colorname[mousefg], &xmousefg) == 0) {
-		xmousefg.red   = 0xffff;
-		xmousefg.green = 0xffff;
-		xmousefg.blue  = 0xffff;
-	}
-
-	if (XParseColor(xw.dpy, xw.cmap, colorname[mousebg], &xmousebg) == 0) {
-		xmousebg.red   = 0x0000;
-		xmousebg.green = 0x0000;
-		xmousebg.blue  = 0x0000;
-	}
-
-	XRecolorCursor(xw.dpy, cursor, &xmousefg, &xmousebg);
+	xw.ime.xic = NULL;
+	if (xw.ime.xim)
+		xicopen();
 
-	xw.xembed = XInternAtom(xw.dpy, "_XEMBED", False);
-	xw.wmdeletewin = XInternAtom(xw.dpy, "WM_DELETE_WINDOW", False);
-	xw.netwmname = XInternAtom(xw.dpy, "_NET_WM_NAME", False);
-	xw.netwmiconname = XInternAtom(xw.dpy, "_NET_WM_ICON_NAME", False);
+	XDefineCursor(xw.dpy, xw.win, xw.pointer);
 	XSetWMProtocols(xw.dpy, xw.win, &xw.wmdeletewin, 1);
-
-	xw.netwmpid = XInternAtom(xw.dpy, "_NET_WM_PID", False);
 	XChangeProperty(xw.dpy, xw.win, xw.netwmpid, XA_CARDINAL, 32,
 			PropModeReplace, (uchar *)&thispid, 1);
 
@@ -1104,18 +2415,12 @@ xinit(int cols, int rows)
 	xhints();
 	XMapWindow(xw.dpy, xw.win);
 	XSync(xw.dpy, False);
-
-	clock_gettime(CLOCK_MONOTONIC, &xsel.tclick1);
-	clock_gettime(CLOCK_MONOTONIC, &xsel.tclick2);
-	xsel.primary = NULL;
-	xsel.clipboard = NULL;
-	xsel.xtarget = XInternAtom(xw.dpy, "UTF8_STRING", 0);
-	if (xsel.xtarget == None)
-		xsel.xtarget = XA_STRING;
 }
 
+/* attrs are the attributes the glyphs are indices into */
 int
-xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
+xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs,
+                    const Attr *attrs, int len, int x, int y)
 {
 	float winx = borderpx + x * win.cw, winy = borderpx + y * win.ch, xp, yp;
 	ushort mode, prevmode = USHRT_MAX;
@@ -1133,7 +2438,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 	for (i = 0, xp = winx, yp = winy + font->ascent; i < len; ++i) {
 		/* Fetch rune and mode for current glyph. */
 		rune = glyphs[i].u;
-		mode = glyphs[i].mode;
+		mode = attrs[glyphs[i].a].mode;
 
 		/* Skip dummy wide-character spacing. */
 		if (mode == ATTR_WDUMMY)
@@ -1142,19 +2447,15 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		/* Determine font for glyph if different from previous glyph. */
 		if (prevmode != mode) {
 			prevmode = mode;
-			font = &dc.font;
 			frcflags = FRC_NORMAL;
 			runewidth = win.cw * ((mode & ATTR_WIDE) ? 2.0f : 1.0f);
-			if ((mode & ATTR_ITALIC) && (mode & ATTR_BOLD)) {
-				font = &dc.ibfont;
+			if ((mode & ATTR_ITALIC) && (mode & ATTR_BOLD))
 				frcflags = FRC_ITALICBOLD;
-			} else if (mode & ATTR_ITALIC) {
-				font = &dc.ifont;
+			else if (mode & ATTR_ITALIC)
 				frcflags = FRC_ITALIC;
-			} else if (mode & ATTR_BOLD) {
-				font = &dc.bfont;
+			else if (mode & ATTR_BOLD)
 				frcflags = FRC_BOLD;
-			}
+			font = xloadvariant(frcflags);
 			yp = winy + font->ascent;
 		}
 
@@ -1185,6 +2486,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 
 		/* Nothing was found. Use fontconfig to find matching font. */
 		if (f >= frclen) {
+			xfontconfigure(font);
 			if (!font->set)
 				font->set = FcFontSort(0, font->pattern, 1, 0, &fcres);
 			fcsets[0] = font->set;
@@ -1244,7 +2546,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 }
 
 void
-xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, int y)
+xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Attr base, int len, int x, int y)
 {
 	int charlen = len * ((base.mode & ATTR_WIDE) ? 2 : 1);
 	int winx = borderpx + x * win.cw, winy = borderpx + y * win.ch,
@@ -1374,55 +2676,61 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 	XftDrawSetClip(xw.draw, 0);
 }
 
+/* Draw g with attributes a instead of its own */
 void
-xdrawglyph(Glyph g, int x, int y)
+xdrawglyph(Glyph g, Attr a, int x, int y)
 {
 	int numspecs;
 	XftGlyphFontSpec spec;
 
-	numspecs = xmakeglyphfontspecs(&spec, &g, 1, x, y);
-	xdrawglyphfontspecs(&spec, g, numspecs, x, y);
+	g.a = 0;
+	numspecs = xmakeglyphfontspecs(&spec, &g, &a, 1, x, y);
+	xdrawglyphfontspecs(&spec, a, numspecs, x, y);
 }
 
 void
 xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 {
 	Color drawcol;
+	const Attr *attrs = tattrs(cur->term);
+	Attr a = attrs[g.a], oa = attrs[og.a];
 
 	/* remove the old cursor */
-	if (selected(ox, oy))
-		og.mode ^= ATTR_REVERSE;
-	xdrawglyph(og, ox, oy);
+	if (selected(cur->term, ox, oy))
+		oa.mode ^= ATTR_REVERSE;
+	xdrawglyph(og, oa, cur->col + ox, cur->row + oy);
 
 	if (IS_SET(MODE_HIDE))
 		return;
 
 	/* Select the right color for the right mode. */
-	g.mode &= ATTR_BOLD|ATTR_ITALIC|ATTR_UNDERLINE|ATTR_STRUCK|ATTR_WIDE;
+	a.mode &= ATTR_BOLD|ATTR_ITALIC|ATTR_UNDERLINE|ATTR_STRUCK|ATTR_WIDE;
 
 	if (IS_SET(MODE_REVERSE)) {
-		g.mode |= ATTR_REVERSE;
-		g.bg = defaultfg;
-		if (selected(cx, cy)) {
+		a.mode |= ATTR_REVERSE;
+		a.bg = defaultfg;
+		if (selected(cur->term, cx, cy)) {
 			drawcol = dc.col[defaultcs];
-			g.fg = defaultrcs;
+			a.fg = defaultrcs;
 		} else {
 			drawcol = dc.col[defaultrcs];
-			g.fg = defaultcs;
+			a.fg = defaultcs;
 		}
 	} else {
-		if (selected(cx, cy)) {
-			g.fg = defaultfg;
-			g.bg = defaultrcs;
+		if (selected(cur->term, cx, cy)) {
+			a.fg = defaultfg;
+			a.bg = defaultrcs;
 		} else {
-			g.fg = defaultbg;
-			g.bg = defaultcs;
+			a.fg = defaultbg;
+			a.bg = defaultcs;
 		}
-		drawcol = dc.col[g.bg];
+		drawcol = dc.col[a.bg];
 	}
 
 	/* draw the new one */
-	if (IS_SET(MODE_FOCUSED)) {
+	cx += cur->col;
+	cy += cur->row;
+	if (IS_SET(MODE_FOCUSED) && cur == active) {
 		switch (win.cursor) {
 		case 7: /* st extension */
 			g.u = 0x2603; /* snowman (U+2603) */
@@ -1430,7 +2738,7 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 		case 0: /* Blinking Block */
 		case 1: /* Blinking Block (Default) */
 		case 2: /* Steady Block */
-			xdrawglyph(g, cx, cy);
+			xdrawglyph(g, a, cx, cy);
 			break;
 		case 3: /* Blinking Underline */
 		case 4: /* Steady Underline */
@@ -1491,6 +2799,15 @@ xseticontitle(char *p)
 
 void
 xsettitle(char *p)
+{
+	free(title);
+	title = p ? xstrdup(p) : NULL;
+	if (!search.pane)
+		setwmname(title);
+}
+
+void
+setwmname(char *p)
 {
 	XTextProperty prop;
 	DEFAULT(p, opt_title);
@@ -1510,20 +2827,27 @@ xstartdraw(void)
 void
 xdrawline(Line line, int x1, int y1, int x2)
 {
-	int i, x, ox, numspecs;
+	int i, x, ox, numspecs, sel, basesel = 0, sx1, sx2;
 	Glyph base, new;
+	Attr attr;
 	XftGlyphFontSpec *specs = xw.specbuf;
+	const Attr *attrs = tattrs(cur->term);
+	const char *found = tfound(cur->term);
+
+	numspecs = xmakeglyphfontspecs(specs, &line[x1], attrs, x2 - x1,
+	                               cur->col + x1, cur->row + y1);
 
-	numspecs = xmakeglyphfontspecs(specs, &line[x1], x2 - x1, x1, y1);
+	if (!selspan(cur->term, y1, &sx1, &sx2))
+		sx1 = sx2 = 0;
 	i = ox = 0;
 	for (x = x1; x < x2 && i < numspecs; x++) {
 		new = line[x];
-		if (new.mode == ATTR_WDUMMY)
+		if (attrs[new.a].mode == ATTR_WDUMMY)
 			continue;
-		if (selected(x, y1))
-			new.mode ^= ATTR_REVERSE;
-		if (i > 0 && ATTRCMP(base, new)) {
-			xdrawglyphfontspecs(specs, base, i, ox, y1);
+		sel = (x >= sx1 && x < sx2) || (found && found[x]);
+		if (i > 0 && (ATTRCMP(base, new) || sel != basesel)) {
+			xdrawglyphfontspecs(specs, attr, i, cur->col + ox,
+			                    cur->row + y1);
 			specs += i;
 			numspecs -= i;
 			i = 0;
@@ -1531,17 +2855,33 @@ xdrawline(Line line, int x1, int y1, int x2)
 		if (i == 0) {
 			ox = x;
 			base = new;
+			basesel = sel;
+			attr = attrs[base.a];
+			if (sel)
+				attr.mode ^= ATTR_REVERSE;
 		}
 		i++;
 	}
 	if (i > 0)
-		xdrawglyphfontspecs(specs, base, i, ox, y1);
+		xdrawglyphfontspecs(specs, attr, i, cur->col + ox, cur->row + y1);
 }
 
 void
 xfinishdraw(void)
 {
-	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w, win.h, 0, 0);
+	int x0 = 0, y0 = 0, x1 = win.w, y1 = win.h;
+
+	/* only the pane has changed, and the window border next to it */
+	if (cur->col > 0)
+		x0 = borderpx + cur->col * win.cw;
+	if (cur->row > 0)
+		y0 = borderpx + cur->row * win.ch;
+	if (cur->col + cur->cols < root->cols)
+		x1 = borderpx + (cur->col + cur->cols) * win.cw;
+	if (cur->row + cur->rows < root->rows)
+		y1 = borderpx + (cur->row + cur->rows) * win.ch;
+	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, x0, y0, x1 - x0, y1 - y0,
+	          x0, y0);
 	XSetForeground(xw.dpy, dc.gc,
 			dc.col[IS_SET(MODE_REVERSE) ? defaultfg : defaultbg].pixel);
 }
@@ -1549,11 +2889,11 @@ xfinishdraw(void)
 void
 xximspot(int x, int y)
 {
-	if (xw.ime.xic == NULL)
+	if (xw.ime.xic == NULL || cur != active)
 		return;
 
-	xw.ime.spot.x = borderpx + x * win.cw;
-	xw.ime.spot.y = borderpx + (y + 1) * win.ch;
+	xw.ime.spot.x = borderpx + (cur->col + x) * win.cw;
+	xw.ime.spot.y = borderpx + (cur->row + y + 1) * win.ch;
 
 	XSetICValues(xw.ime.xic, XNPreeditAttributes, xw.ime.spotlist, NULL);
 }
@@ -1561,7 +2901,7 @@ xximspot(int x, int y)
 void
 expose(XEvent *ev)
 {
-	redraw();
+	redrawall();
 }
 
 void
@@ -1575,6 +2915,8 @@ visibility(XEvent *ev)
 void
 unmap(XEvent *ev)
 {
+	if (ev->xunmap.window != xw.win) /* a requestor, see selrequest() */
+		return;
 	win.mode &= ~MODE_VISIBLE;
 }
 
@@ -1597,7 +2939,7 @@ xmode(uint set, uint clr)
 	int orig = win.mode;
 	win.mode = (~win.mode & set) | (win.mode & ~clr);
 	if ((win.mode & MODE_REVERSE) != (orig & MODE_REVERSE))
-		redraw();
+		redraw(cur->term);
 	return win.mode;
 }
 
@@ -1643,13 +2985,13 @@ focus(XEvent *ev)
 		win.mode |= MODE_FOCUSED;
 		xseturgency(0);
 		if (IS_SET(MODE_FOCUS))
-			ttywrite("\033[I", 3, 0);
+			ttywrite(cur->term, "\033[I", 3, 0);
 	} else {
 		if (xw.ime.xic)
 			XUnsetICFocus(xw.ime.xic);
 		win.mode &= ~MODE_FOCUSED;
 		if (IS_SET(MODE_FOCUS))
-			ttywrite("\033[O", 3, 0);
+			ttywrite(cur->term, "\033[O", 3, 0);
 	}
 }
 
@@ -1663,7 +3005,7 @@ handlesym(KeySym sym, uint state)
 	/* 1. Custom handling from config */
 	for (k = keys; k->sym; k++) {
 		if (k->sym == sym && MATCH(state, k->set, k->clr)) {
-			k->fn(state, k->arg);
+			k->fn(cur->term, state, k->arg);
 			return 1;
 		}
 	}
@@ -1688,7 +3030,7 @@ handlesym(KeySym sym, uint state)
 				len = 2;
 			}
 		}
-		ttywrite(buf, len, 1);
+		ttywrite(cur->term, buf, len, 1);
 		return 1;
 	}
 
@@ -1713,6 +3055,12 @@ kaction(XKeyEvent *e, int release)
 	else
 		len = XLookupString(e, buf, sizeof buf, &sym, NULL);
 
+	if (search.pane) {
+		if (!release)
+			searchkey(sym, buf, len);
+		return;
+	}
+
 	/* 1. Sym  */
 	if (sym != NoSymbol && handlesym(sym, state))
 		return;
@@ -1727,7 +3075,89 @@ kaction(XKeyEvent *e, int release)
 	/* 3. Default to directly sending composed string from the input method
 	 * (might not be UTF8; encoding is dependent on locale of input method) */
 
-	ttywrite(buf, len, 1);
+	ttywrite(cur->term, buf, len, 1);
+}
+
+/* Incremental search: the matches of the query are shown as it is typed.
+ * Return selects the last one, and both Return and Escape end the search
+ * and remove the highlights. */
+void
+xsearch(void)
+{
+	if (search.pane)
+		return;
+	search.pane = active;
+	search.len = 0;
+	searchtitle();
+}
+
+void
+searchkey(KeySym sym, const char *buf, size_t len)
+{
+	size_t n;
+	Rune u;
+
+	switch (sym) {
+	case XK_Escape:
+		searchend(0);
+		return;
+	case XK_Return:
+	case XK_KP_Enter:
+		searchend(1);
+		return;
+	case XK_BackSpace:
+		if (search.len == 0)
+			return;
+		search.len--;
+		break;
+	default:
+		for (; len > 0; buf += n, len -= n) {
+			if ((n = utf8dec(buf, &u, len)) == 0)
+				break;
+			if (u < 0x20 || u == 0x7f || u == UTF_INVALID)
+				continue;
+			if (search.len == search.siz) {
+				search.siz = 2 * search.siz + 16;
+				search.q = xrealloc(search.q,
+				                    search.siz * sizeof(Rune));
+			}
+			search.q[search.len++] = u;
+		}
+		break;
+	}
+	tsearch(search.pane->term, search.q, search.len);
+	searchtitle();
+}
+
+void
+searchend(int sel)
+{
+	Term *term = search.pane->term;
+
+	if (sel && tsearchsel(term))
+		setsel(getsel(term), CurrentTime);
+	tsearch(term, NULL, 0);
+	search.pane = NULL;
+	searchtitle();
+}
+
+void
+searchtitle(void)
+{
+	char *s;
+	int i, n;
+
+	if (!search.pane) {
+		setwmname(title);
+		return;
+	}
+	s = xmalloc(sizeof("search: ") + search.len * UTF_SIZ);
+	n = sprintf(s, "search: ");
+	for (i = 0; i < search.len; i++)
+		n += utf8enc(search.q[i], s + n);
+	s[n] = '\0';
+	setwmname(s);
+	free(s);
 }
 
 void
@@ -1749,6 +3179,8 @@ krelease(XEvent *e)
 void
 cmessage(XEvent *e)
 {
+	Pane *p;
+
 	/* See xembed specs:
 	 * http://standards.freedesktop.org/xembed-spec/xembed-spec-latest.html */
 	if (e->xclient.message_type == xw.xembed && e->xclient.format == 32) {
@@ -1759,29 +3191,30 @@ cmessage(XEvent *e)
 			win.mode &= ~MODE_FOCUSED;
 		}
 	} else if (e->xclient.data.l[0] == xw.wmdeletewin) {
-		ttyhangup();
-		exit(0);
+		for (p = panes; p; p = p->next)
+			ttyhangup(p->term);
+		closewin();
 	}
 }
 
+/* Dragging the window sends a stream of these: only the last size is
+ * applied, once per frame by xflushresize() */
 void
 resize(XEvent *e)
 {
-	if (e->xconfigure.width == win.w && e->xconfigure.height == win.h)
+	if (e->xconfigure.window != xw.win) /* as in unmap() */
 		return;
-
-	cresize(e->xconfigure.width, e->xconfigure.height);
+	win.pw = e->xconfigure.width;
+	win.ph = e->xconfigure.height;
 }
 
+/* st without -d: the shell starts once the window is mapped, with the size
+ * it was mapped in */
 void
-run(void)
+xstart(void)
 {
 	XEvent ev;
 	int w = win.w, h = win.h;
-	fd_set rfd;
-	int xfd = XConnectionNumber(xw.dpy), ttyfd, xev, drawing;
-	struct timespec seltv, *tv, now, lastblink, trigger;
-	double timeout;
 
 	/* Waiting for window mapping */
 	do {
@@ -1797,13 +3230,43 @@ run(void)
 		}
 	} while (ev.type != MapNotify);
 
-	ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
+	if (opt_play)
+		ttyreplay(opt_play, opt_playfast);
+	if (opt_sess)
+		root->ttyfd = ttyattach(root->term, opt_sess, opt_cmd);
+	else
+		panetty(root, opt_line, opt_io, opt_cmd);
+	if (opt_rec)
+		ttyrecord(root->term, opt_rec);
 	cresize(w, h);
+}
+
+void
+run(void)
+{
+	XEvent ev;
+	Win *w, *wnext;
+	Pane *p, *next;
+	fd_set rfd;
+	int xfd = XConnectionNumber(xw.dpy), maxfd, ttyin, xev, drawing;
+	int blink, blinked, blinkhide = 0;
+	struct timespec seltv, *tv, now, lastblink, trigger;
+	double timeout;
 
 	for (timeout = -1, drawing = 0, lastblink = (struct timespec){0};;) {
 		FD_ZERO(&rfd);
-		FD_SET(ttyfd, &rfd);
 		FD_SET(xfd, &rfd);
+		maxfd = xfd;
+		if (sfd >= 0) {
+			FD_SET(sfd, &rfd);
+			maxfd = MAX(maxfd, sfd);
+		}
+		for (w = wins; w; w = w->next) {
+			for (p = winpanes(w); p; p = p->next) {
+				FD_SET(p->ttyfd, &rfd);
+				maxfd = MAX(maxfd, p->ttyfd);
+			}
+		}
 
 		if (XPending(xw.dpy))
 			timeout = 0;  /* existing events might not set xfd */
@@ -1812,15 +3275,33 @@ run(void)
 		seltv.tv_nsec = 1E6 * (timeout - 1E3 * seltv.tv_sec);
 		tv = timeout >= 0 ? &seltv : NULL;
 
-		if (pselect(MAX(xfd, ttyfd)+1, &rfd, NULL, NULL, tv, NULL) < 0) {
+		ttyreap();
+		if (pselect(maxfd+1, &rfd, NULL, NULL, tv, NULL) < 0) {
 			if (errno == EINTR)
 				continue;
 			die("select failed: %s\n", strerror(errno));
 		}
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
-		if (FD_ISSET(ttyfd, &rfd))
-			ttyread();
+		/* a window goes with the last of its panes */
+		for (ttyin = 0, w = wins; w; w = wnext) {
+			wnext = w->next;
+			for (p = winpanes(w); p; p = next) {
+				next = p->next;
+				if (!FD_ISSET(p->ttyfd, &rfd))
+					continue;
+				ttyin = 1;
+				setwin(w);
+				setcur(p);
+				if (ttyread(p->term) == 0)
+					closepane(p);
+				else
+					setcur(active);
+			}
+		}
+
+		if (sfd >= 0 && FD_ISSET(sfd, &rfd))
+			xaccept();
 
 		xev = 0;
 		while (XPending(xw.dpy)) {
@@ -1828,6 +3309,13 @@ run(void)
 			XNextEvent(xw.dpy, &ev);
 			if (XFilterEvent(&ev, None))
 				continue;
+			/* those of other windows are about selections, see
+			 * selrequest(), and of windows already closed */
+			if ((w = winof(ev.xany.window)))
+				setwin(w);
+			else if (ev.type != PropertyNotify &&
+			         ev.type != DestroyNotify)
+				continue;
 			if (handler[ev.type])
 				(handler[ev.type])(&ev);
 		}
@@ -1841,7 +3329,7 @@ run(void)
 		 * Typically this results in low latency while interacting,
 		 * maximum latency intervals during `cat huge.txt`, and perfect
 		 * sync with periodic updates from animations/key-repeats/etc. */
-		if (FD_ISSET(ttyfd, &rfd) || xev) {
+		if (ttyin || xev) {
 			if (!drawing) {
 				trigger = now;
 				drawing = 1;
@@ -1854,106 +3342,317 @@ run(void)
 
 		/* idle detected or maxlatency exhausted -> draw */
 		timeout = -1;
-		if (blinktimeout && tattrset(ATTR_BLINK)) {
+		for (blink = 0, w = wins; w && !blink; w = w->next) {
+			for (p = winpanes(w); p && !blink; p = p->next)
+				blink = tattrset(p->term, ATTR_BLINK);
+		}
+		blinked = 0;
+		if (blinktimeout && blink) {
 			timeout = blinktimeout - TIMEDIFF(now, lastblink);
 			if (timeout <= 0) {
 				if (-timeout > blinktimeout) /* start visible */
-					win.mode |= MODE_BLINK;
-				win.mode ^= MODE_BLINK;
-				tsetdirtattr(ATTR_BLINK);
+					blinkhide = 1;
+				blinkhide = !blinkhide;
+				blinked = 1;
 				lastblink = now;
 				timeout = blinktimeout;
 			}
 		}
 
-		draw();
+		for (w = wins; w; w = w->next) {
+			setwin(w);
+			if (blinked) {
+				MODBIT(win.mode, blinkhide, MODE_BLINK);
+				for (p = panes; p; p = p->next)
+					tsetdirtattr(p->term, ATTR_BLINK);
+			}
+			xflushresize();
+			xflushcolors();
+			for (p = panes; p; p = p->next) {
+				setcur(p);
+				draw(p->term);
+			}
+			setcur(active);
+		}
 		XFlush(xw.dpy);
 		drawing = 0;
 	}
 }
 
+/* Reads what stc sends: cwd, argc, argv[] and the environment. The strings
+ * point into the returned buffer, which starts with the cwd, or it is NULL
+ * for a bad request. The first entry of env is left for WINDOWID. */
+char *
+recvargs(int fd, int *argc, char ***argv, char ***env)
+{
+	char *buf = NULL, *p, *end;
+	size_t len = 0, siz = 0;
+	ssize_t r;
+	int i, n;
+
+	do {
+		if (siz - len < BUFSIZ)
+			buf = xrealloc(buf, siz = 2 * siz + BUFSIZ);
+		if ((r = read(fd, buf + len, siz - len - 1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "read from client failed: %s\n",
+			        strerror(errno));
+			free(buf);
+			return NULL;
+		}
+		len += r;
+	} while (r > 0);
+	buf[len] = '\0';
+	end = buf + len;
+
+	p = buf + strlen(buf) + 1;
+	if (p >= end || (*argc = atoi(p)) < 1 || *argc > end - p)
+		goto bad;
+	p += strlen(p) + 1;
+
+	*argv = xmalloc((*argc + 1) * sizeof(char *));
+	for (i = 0; i < *argc; i++, p += strlen(p) + 1) {
+		if (p >= end) {
+			free(*argv);
+			goto bad;
+		}
+		(*argv)[i] = p;
+	}
+	(*argv)[i] = NULL;
+
+	*env = xmalloc(2 * sizeof(char *));
+	for (n = 1; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "WINDOWID=", 9))
+			continue;
+		*env = xrealloc(*env, (n + 2) * sizeof(char *));
+		(*env)[n++] = p;
+	}
+	(*env)[0] = NULL;
+	(*env)[n] = NULL;
+
+	return buf;
+
+bad:
+	fprintf(stderr, "bad request from client\n");
+	free(buf);
+	return NULL;
+}
+
+/* st -d: instead of opening a window, st listens for stc and opens one for
+ * each request, see xaccept(). The windows share the display, the fonts with
+ * their glyph cache and the configured palette. */
+void
+serve(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	mode_t mask;
+
+	strcpy(sa.sun_path, sockpath(NULL));
+	if ((sfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("socket failed: %s\n", strerror(errno));
+	fcntl(sfd, F_SETFD, FD_CLOEXEC);
+	unlink(sa.sun_path);
+	mask = umask(077);
+	if (bind(sfd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die("bind %s failed: %s\n", sa.sun_path, strerror(errno));
+	umask(mask);
+	if (listen(sfd, 16) < 0)
+		die("listen failed: %s\n", strerror(errno));
+
+	ttyserve();
+	srvopt.class = opt_class;
+	srvopt.cmd = opt_cmd;
+	srvopt.embed = opt_embed;
+	srvopt.name = opt_name;
+	srvopt.rec = opt_rec;
+	srvopt.title = opt_title;
+	srvopt.cols = cols;
+	srvopt.rows = rows;
+	srvopt.l = xw.l;
+	srvopt.t = xw.t;
+	srvopt.gm = xw.gm;
+	srvopt.isfixed = xw.isfixed;
+	srvopt.altscreen = allowaltscreen;
+}
+
+/* Opens a window for the stc connecting to st -d, with the working directory
+ * and environment it sends for the shell. Options for the whole process,
+ * such as the font, are the server's, see st(1). */
+void
+xaccept(void)
+{
+	char *req, *name = argv0, **argv, **env;
+	int fd, argc, r;
+
+	if ((fd = accept(sfd, NULL, NULL)) < 0) {
+		if (errno != EINTR)
+			fprintf(stderr, "accept failed: %s\n", strerror(errno));
+		return;
+	}
+	req = recvargs(fd, &argc, &argv, &env);
+	close(fd);
+	if (!req)
+		return;
+
+	setwin(NULL);
+	opt_class = srvopt.class;
+	opt_cmd = srvopt.cmd;
+	opt_embed = srvopt.embed;
+	opt_name = srvopt.name;
+	opt_rec = srvopt.rec;
+	opt_title = srvopt.title;
+	cols = srvopt.cols;
+	rows = srvopt.rows;
+	xw.l = srvopt.l;
+	xw.t = srvopt.t;
+	xw.gm = srvopt.gm;
+	xw.isfixed = srvopt.isfixed;
+	r = options(argc, argv);
+	argv0 = name;
+	allowaltscreen = srvopt.altscreen;
+	if (r < 0) {
+		fprintf(stderr, "bad options from client\n");
+		free(argv);
+		free(env);
+		free(req);
+		return;
+	}
+	if (!opt_title)
+		opt_title = opt_cmd ? opt_cmd[0] : "st";
+
+	xnewwin(cols, rows);
+	wcur->req = req;
+	wcur->argv = argv;
+	wcur->env = env;
+	snprintf(wcur->windowid, sizeof(wcur->windowid), "WINDOWID=%lu",
+	         xw.win);
+	env[0] = wcur->windowid;
+	panetty(root, NULL, NULL, opt_cmd);
+	if (opt_rec)
+		ttyrecord(root->term, opt_rec);
+	cresize(0, 0);
+}
+
 void
 usage(void)
 {
-	die("usage: %s [-aiv] [-c class] [-f font] [-g geometry]"
+	die("usage: %s [-adiv] [-c class] [-f font] [-g geometry]"
+	    " [-n name] [-o file]\n"
+	    "          [-r file] [-s session] [-T title] [-t title]"
+	    " [-w windowid]\n"
+	    "          [[-e] command [args ...]]\n"
+	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid]"
-	    " [[-e] command [args ...]]\n"
+	    "          [-r file] [-T title] [-t title] [-w windowid] -l line"
+	    " [stty_args ...]\n"
 	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid] -l line"
-	    " [stty_args ...]\n", argv0, argv0);
+	    "          [-T title] [-t title] [-w windowid] -p|-P file\n",
+	    argv0, argv0, argv0);
 }
 
-/* TODO it is weird that main is in x.c and not st.c. Probably, the tty stuff
- * should be in tty.c, the X stuff should be in win.c, and the "neutral"
- * stuff (e.g., main) should be in st.c. */
+/* Sets the options from argv, those of st or of a window of st -d, which
+ * must not exit for bad usage. Returns -1 for that. */
 int
-main(int argc, char *argv[])
+options(int argc, char *argv[])
 {
-	xw.l = xw.t = 0;
-	xw.isfixed = False;
-	/* TODO why is this here? Probably this belongs in xinit. */
-	xsetcursor(cursorshape);
+	char *a;
 
 	ARGBEGIN {
 	case 'a':
 		allowaltscreen = 0;
 		break;
 	case 'c':
-		opt_class = EARGF(usage());
+		OPTARG(opt_class);
+		break;
+	case 'd':
+		opt_daemon = 1;
 		break;
 	case 'e':
 		if (argc > 0)
 			--argc, ++argv;
-		goto run;
+		goto cmd;
 	case 'f':
-		opt_font = EARGF(usage());
+		OPTARG(opt_font);
 		break;
 	case 'g':
-		xw.gm = XParseGeometry(EARGF(usage()), &xw.l, &xw.t, &cols, &rows);
+		OPTARG(a);
+		xw.gm = XParseGeometry(a, &xw.l, &xw.t, &cols, &rows);
 		break;
 	case 'i':
 		xw.isfixed = 1;
 		break;
 	case 'o':
-		opt_io = EARGF(usage());
+		OPTARG(opt_io);
+		break;
+	case 'P':
+		opt_playfast = 1;
+		/* FALLTHROUGH */
+	case 'p':
+		OPTARG(opt_play);
+		break;
+	case 'r':
+		OPTARG(opt_rec);
+		break;
+	case 's':
+		OPTARG(opt_sess);
 		break;
 	case 'l':
-		opt_line = EARGF(usage());
+		OPTARG(opt_line);
 		break;
 	case 'n':
-		opt_name = EARGF(usage());
+		OPTARG(opt_name);
 		break;
 	case 't':
 	case 'T':
-		opt_title = EARGF(usage());
+		OPTARG(opt_title);
 		break;
 	case 'w':
-		opt_embed = EARGF(usage());
+		OPTARG(opt_embed);
 		break;
 	case 'v':
+		if (sfd >= 0)
+			return -1;
 		die("%s " VERSION "\n", argv0);
 		break;
 	default:
-		usage();
+		return -1;
 	} ARGEND;
 
-run:
+cmd:
 	if (argc > 0) /* eat all remaining arguments */
 		opt_cmd = argv;
 
-	if (!opt_title)
-		opt_title = (opt_line || !opt_cmd) ? "st" : opt_cmd[0];
+	return 0;
+}
+
+/* TODO it is weird that main is in x.c and not st.c. Probably, the tty stuff
+ * should be in tty.c, the X stuff should be in win.c, and the "neutral"
+ * stuff (e.g., main) should be in st.c. */
+int
+main(int argc, char *argv[])
+{
+	xw.l = xw.t = 0;
+	xw.isfixed = False;
+
+	if (options(argc, argv) < 0)
+		usage();
 
 	setlocale(LC_CTYPE, "");
 	XSetLocaleModifiers("");
-	cols = MAX(cols, 1);
-	rows = MAX(rows, 1);
-	tnew(cols, rows);
-	xinit(cols, rows);
-	xsetenv();
-	selinit();
+	xsetup();
+
+	/* the command of the server is the default of its windows too */
+	if (opt_daemon) {
+		serve();
+	} else {
+		if (!opt_title)
+			opt_title = (opt_line || !opt_cmd) ? "st" : opt_cmd[0];
+		xnewwin(cols, rows);
+		xsetenv();
+		xstart();
+	}
 	run();
 
 	return 0;
@@ -0,0 +1,249 @@
+/* See LICENSE for license details. */
+
+/* Render benchmark: the X frontend is compiled in as is, its main() renamed
+ * out of the way, so that frames go through the very same drawregion(),
+ * xdrawline() and xfinishdraw() as in st. Run it against a dedicated X
+ * server, see the xbench target in the Makefile. */
+#define main xmain
+#include "x.c"
+#undef main
+
+static void genpieces(int, const char **, int);
+static void genascii(int);
+static void gensgr(int);
+static void gentruecolor(int);
+static void gencjk(int);
+static void genemoji(int);
+static void xbench(const char *, void (*)(int), int);
+static int dblcmp(const void *, const void *);
+static void xbenchusage(void);
+
+static struct {
+	const char *name;
+	void (*gen)(int);
+	int sel;
+} xworkloads[] = {
+	{ "ascii",     genascii,     0 },
+	{ "sgr256",    gensgr,       0 },
+	{ "truecolor", gentruecolor, 0 },
+	{ "cjk",       gencjk,       0 },
+	{ "emoji",     genemoji,     0 },
+	{ "selection", genascii,     1 },
+};
+
+static int nframes = 500;
+
+/* Every generator fills the whole screen for frame f; varying f keeps the
+ * contents changing between frames like a scrolling terminal would. */
+void
+genascii(int f)
+{
+	char buf[64];
+	int y, n;
+
+	twrite(cur->term, "\033[H", 3, 0);
+	for (y = 0; y < rows; y++) {
+		n = snprintf(buf, sizeof(buf), "%d: [info] request %08x served"
+		             " in %d ms\033[K", f + y, (f + y) * 2654435761U,
+		             (f * 7 + y) % 997);
+		twrite(cur->term, buf, n, 0);
+		if (y < rows - 1)
+			twrite(cur->term, "\r\n", 2, 0);
+	}
+}
+
+void
+gensgr(int f)
+{
+	char buf[32];
+	int x, y, i, n;
+
+	twrite(cur->term, "\033[H", 3, 0);
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < cols; x++) {
+			i = f + y * cols + x;
+			n = snprintf(buf, sizeof(buf), "\033[38;5;%dm\033[48;5;%dm%c",
+			             i % 256, (i / 7) % 256, ' ' + 1 + i % 94);
+			twrite(cur->term, buf, n, 0);
+		}
+		twrite(cur->term, "\033[0m", 4, 0);
+		if (y < rows - 1)
+			twrite(cur->term, "\r\n", 2, 0);
+	}
+}
+
+void
+gentruecolor(int f)
+{
+	char buf[64];
+	int x, y, n;
+
+	twrite(cur->term, "\033[H", 3, 0);
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < cols; x++) {
+			n = snprintf(buf, sizeof(buf),
+			             "\033[38;2;%d;%d;%dm\033[48;2;%d;%d;%dm▀",
+			             (x * 255 / cols + f) % 256,
+			             y * 255 / rows, f % 256,
+			             255 - (x * 255 / cols),
+			             (y * 255 / rows + f) % 256, 128);
+			twrite(cur->term, buf, n, 0);
+		}
+		twrite(cur->term, "\033[0m", 4, 0);
+		if (y < rows - 1)
+			twrite(cur->term, "\r\n", 2, 0);
+	}
+}
+
+void
+genpieces(int f, const char **pieces, int n)
+{
+	const char *s;
+	int y, i;
+
+	twrite(cur->term, "\033[H", 3, 0);
+	for (y = 0; y < rows; y++) {
+		twrite(cur->term, "\033[K", 3, 0);
+		/* the line wraps silently once it is full */
+		for (i = 0; i < cols; i++) {
+			s = pieces[(f + y + i) % n];
+			twrite(cur->term, s, strlen(s), 0);
+		}
+		twrite(cur->term, "\r", 1, 0);
+		if (y < rows - 1)
+			twrite(cur->term, "\n", 1, 0);
+	}
+}
+
+void
+gencjk(int f)
+{
+	static const char *pieces[] = {
+		"日", "本", "語", "の", "テ", "キ", "ス", "ト", "한", "국",
+		"어", "中", "文", "字", "符", " ",
+	};
+
+	genpieces(f, pieces, LEN(pieces));
+}
+
+/* mostly glyphs missing from the main font, exercising the fallback path */
+void
+genemoji(int f)
+{
+	static const char *pieces[] = {
+		"\U0001F600", "\U0001F680", "\U0001F40D", "☃", "❤",
+		"\U0001F468‍\U0001F469‍\U0001F467", "a", "é",
+		"أ", "\U0001D11E", " ",
+	};
+
+	genpieces(f, pieces, LEN(pieces));
+}
+
+int
+dblcmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+void
+xbench(const char *name, void (*gen)(int), int sel)
+{
+	struct timespec t0, t1;
+	double *ft, sum = 0;
+	int f;
+
+	ft = xmalloc(nframes * sizeof(*ft));
+	twrite(cur->term, "\033c", 2, 0);
+	for (f = 0; f < nframes; f++) {
+		gen(f);
+		if (sel) {
+			selstart(cur->term, f % cols, 0, 0);
+			selextend(cur->term, cols - 1 - f % cols, rows - 1,
+			          SEL_REGULAR, 0);
+		}
+
+		/* a full frame, including the time the server spends on it */
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		redraw(cur->term);
+		XSync(xw.dpy, False);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		sum += ft[f] = TIMEDIFF(t1, t0);
+	}
+	if (sel)
+		selclear(cur->term);
+
+	qsort(ft, nframes, sizeof(*ft), dblcmp);
+	printf("%-10s %6d %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", name,
+	       nframes, sum / nframes, ft[0], ft[nframes / 2],
+	       ft[nframes * 90 / 100], ft[nframes * 99 / 100], ft[nframes - 1]);
+	fflush(stdout);
+	free(ft);
+}
+
+void
+xbenchusage(void)
+{
+	die("usage: %s [-f font] [-g colsxrows] [-n frames] [workload ...]\n",
+	    argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	XEvent ev;
+	size_t i;
+	int j;
+
+	xw.l = xw.t = 0;
+	xw.isfixed = False;
+
+	ARGBEGIN {
+	case 'f':
+		opt_font = EARGF(xbenchusage());
+		break;
+	case 'g':
+		if (sscanf(EARGF(xbenchusage()), "%ux%u", &cols, &rows) != 2)
+			xbenchusage();
+		break;
+	case 'n':
+		nframes = atoi(EARGF(xbenchusage()));
+		break;
+	default:
+		xbenchusage();
+	} ARGEND;
+
+	opt_title = "st-xbench";
+	setlocale(LC_CTYPE, "");
+	XSetLocaleModifiers("");
+	cols = MAX(cols, 1);
+	rows = MAX(rows, 1);
+	nframes = MAX(nframes, 1);
+	xsetup();
+	xnewwin(cols, rows);
+
+	/* frames drawn before mapping would never reach the window */
+	do {
+		XNextEvent(xw.dpy, &ev);
+	} while (ev.type != MapNotify);
+	win.mode |= MODE_VISIBLE;
+
+	/* times are in milliseconds per frame */
+	printf("%-10s %6s %8s %8s %8s %8s %8s %8s\n", "workload", "frames",
+	       "mean", "min", "p50", "p90", "p99", "max");
+	for (i = 0; i < LEN(xworkloads); i++) {
+		if (argc > 0) {
+			for (j = 0; j < argc; j++) {
+				if (!strcmp(argv[j], xworkloads[i].name))
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+		xbench(xworkloads[i].name, xworkloads[i].gen,
+		       xworkloads[i].sel);
+	}
+
+	return 0;
+}